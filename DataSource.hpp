@@ -1,488 +1,3250 @@
+#ifndef DATA_SOURCE_HPP
+#define DATA_SOURCE_HPP
+
 #include <cinttypes>
 #include <cassert>
 #include <string>
 #include <vector>
-#include <bitset>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <span>
+#include <array>
+#include <iterator>
+#include <ranges>
 #include <semaphore>
 #include <exception>
+#include <chrono>
+#include <climits>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <type_traits>
+#include <concepts>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <DataSourceException.hpp>
 
 using std::byte;
 using std::string;
 using std::vector;
-using std::bitset;
+using std::atomic;
+using std::span;
 using std::binary_semaphore;
 using std::exception;
 
 
+#define DS_CACHE_LINE	64
+
+#define DS_HUGE_PAGE	(size_t(1) << 21)	// The size of the huge pages asked for by DS_HUGE_PAGES.
+
+   /* The modes of operation of a data source, passed to its constructor. */
+   enum
+   {
+      DS_LOCKED,	// Writing and reading sessions exclude each other (the default).
+      DS_SPSC,		// One producer and one reader work at the same time, without locking.
+      DS_SPMC		// One producer and several readers, all working at the same time.
+   };
+
+   /* The options that may be added to the mode, e.g. DS_SPSC | DS_MIRRORED. */
+   enum
+   {
+      DS_MIRRORED = 0x10,	// The buffer is mapped twice in a row, so that its regions are never split.
+      DS_HUGE_PAGES = 0x20,	// The buffer is put into huge pages, if possible.
+      DS_PREFAULT = 0x40,	// Every page of the buffer is faulted in by the constructor.
+      DS_MLOCKED = 0x80		// The buffer is locked into the memory, and thus faulted in as well.
+   };
+
+#define DS_MEMORY_MASK	(DS_HUGE_PAGES | DS_PREFAULT | DS_MLOCKED)
+
+#define DS_MODE_MASK	0x0F
+
+#define DS_FOREVER	std::chrono::nanoseconds::max()	// No timeout for waitReadable() and waitWritable().
+
+   /* Where a reader attached by attachReader() starts reading. */
+   enum
+   {
+      DS_FROM_TAIL,	// From the oldest item still in the buffer.
+      DS_FROM_HEAD,	// From the next item to be written, skipping those already there.
+      DS_FROM_SEQUENCE	// From the item of the given sequence number; see attachReaderAt().
+   };
+
+#define DS_FILE_MAGIC	"DSRING1"	// The beginning of the file of a file-backed data source.
+
+#define DS_FILE_MAGIC_WIDE	"DSRING2"	// The same, for a data source with 64-bit indices.
+
+#define DS_SPILL_LIMIT	(uint32_t(1) << 30)	// The default limit of the items spilled to disk.
+
+#define DS_GROW_STALLS	4	// The default number of stalls that make a resizable buffer grow.
+
+#define DS_SHRINK_IDLE	std::chrono::seconds(10)	// The default time after which it shrinks.
+
+
+   /* A region of the buffer of a data source. Since the buffer is circular, the
+   region may be split in two by its end, in which case "second" starts from the
+   beginning of the buffer; otherwise "second" is empty. The region is a range of
+   its items, so that the standard algorithms can go through it as a whole; a loop
+   that has to be tight goes through segments() instead, one plain array after the
+   other, without looking for the seam at each item. */
+   template<typename T> struct DataSourceSpans
+   {
+      span<T> first;
+
+      span<T> second;
+
+      /* A random-access iterator over both parts, which keeps the position within
+      the region and finds the part only when an item is accessed. */
+      class iterator
+      {
+         T * first = nullptr;
+
+         T * second = nullptr;
+
+         ptrdiff_t seam = 0;		///< The number of the items in the first part.
+
+         ptrdiff_t index = 0;		///< The position within the region.
+
+         public:
+
+         using iterator_concept = std::random_access_iterator_tag;
+         using iterator_category = std::random_access_iterator_tag;
+         using value_type = std::remove_cv_t<T>;
+         using difference_type = ptrdiff_t;
+         using pointer = T *;
+         using reference = T &;
+
+         iterator() = default;
+
+         iterator(T * f, T * s, ptrdiff_t n, ptrdiff_t i) : first(f), second(s), seam(n), index(i) {}
+
+         inline T & operator*() const { return ( index < seam ) ? first[index] : second[index - seam]; }
+
+         inline T * operator->() const { return &**this; }
+
+         inline T & operator[](ptrdiff_t n) const { return *(*this + n); }
+
+         inline iterator & operator++() { index++; return *this; }
+
+         inline iterator operator++(int) { iterator i = *this; index++; return i; }
+
+         inline iterator & operator--() { index--; return *this; }
+
+         inline iterator operator--(int) { iterator i = *this; index--; return i; }
+
+         inline iterator & operator+=(ptrdiff_t n) { index += n; return *this; }
+
+         inline iterator & operator-=(ptrdiff_t n) { index -= n; return *this; }
+
+         friend inline iterator operator+(iterator i, ptrdiff_t n) { return i += n; }
+
+         friend inline iterator operator+(ptrdiff_t n, iterator i) { return i += n; }
+
+         friend inline iterator operator-(iterator i, ptrdiff_t n) { return i -= n; }
+
+         friend inline ptrdiff_t operator-(const iterator & a, const iterator & b) { return a.index - b.index; }
+
+         friend inline bool operator==(const iterator & a, const iterator & b) { return a.index == b.index; }
+
+         friend inline auto operator<=>(const iterator & a, const iterator & b) { return a.index <=> b.index; }
+      };
+
+      inline iterator begin() const { return iterator(first.data(), second.data(), first.size(), 0); }
+
+      inline iterator end() const { return iterator(first.data(), second.data(), first.size(), size()); }
+
+      inline T & operator[](size_t n) const { return ( n < first.size() ) ? first[n] : second[n - first.size()]; }
+
+      /** The two parts, for a loop over each of them; the second may be empty. */
+      inline std::array<span<T>, 2> segments() const { return { first, second }; }
+
+      inline size_t size() const { return first.size() + second.size(); }
+
+      inline bool empty() const { return first.empty(); }
+   };
+
+   // The region is a view into the buffer, which doesn't own the items.
+   template<typename T> inline constexpr bool std::ranges::enable_view<DataSourceSpans<T>> = true;
+
+   template<typename T> inline constexpr bool std::ranges::enable_borrowed_range<DataSourceSpans<T>> = true;
+
+
+   /* Something a coroutine may wait for, e.g. items to read: co_await on it (see
+   DataSourceLoop.hpp) suspends the coroutine until "test" holds. It tells which
+   futex word the other side changes when the condition may have come to hold,
+   and what to count in so that it does; as well as the word of the other side,
+   which the one going to sleep has to wake, like waitReadable() does. */
+   struct DataSourceCondition
+   {
+      bool (*test)(void * source, void * reader, uint64_t amount);
+
+      void * source;
+
+      void * reader;
+
+      uint64_t amount;
+
+      atomic<uint32_t> * event;			///< Changed when "test" may have come to hold.
+
+      atomic<uint32_t> * waiting;		///< The number of those waiting on "event".
+
+      atomic<uint32_t> * opposite;		///< The word the other side waits on.
+
+      atomic<uint32_t> * opposite_waiting;	///< The number of those waiting on "opposite".
+
+      inline bool ready() const { return test(source, reader, amount); }
+   };
+
+
+
+#ifdef DATA_SOURCE_STATS
+   /* A snapshot of the counters of a data source, see dataSourceStats(). The counters
+   are kept only when DATA_SOURCE_STATS is defined, for all the files of the program
+   alike; otherwise they cost nothing. */
+   struct DataSourceStats
+   {
+      uint64_t items_written = 0;	///< The items the producer has published.
+
+      uint64_t bytes_written = 0;	///< The same in bytes, for all the planes.
+
+      uint64_t items_read = 0;		///< The items the readers have gone past, all together.
+
+      uint64_t bytes_read = 0;		///< The same in bytes.
+
+      uint64_t write_sessions = 0;
+
+      uint64_t read_sessions = 0;
+
+      uint64_t write_stalls = 0;	/**< The writing sessions that found the buffer full,
+      					 and the waits in waitWritable(). */
+
+      uint64_t empty_reads = 0;		///< The reading sessions that found nothing new.
+
+      uint64_t high_water = 0;		///< The highest number of items ever in the buffer.
+
+      uint64_t access_wait_ns = 0;	/**< The time spent waiting for the buffer to be
+      					 released, in the DS_LOCKED mode. */
+
+      vector<uint64_t> reader_lag;	/**< For each reader, how far behind the published
+      					 head it was at the end of its last session. */
+   };
+#endif
+
+
+   /* What a data source can hold: anything that can be moved without throwing.
+   Trivially copyable items are copied as they are, with memcpy() and the like;
+   the others are constructed in the buffer, copied or moved out of it, and
+   destroyed once they have been released. */
+   template<typename T> concept DataSourceItem =
+   	std::is_nothrow_move_constructible_v<T> && std::is_nothrow_destructible_v<T>;
+
+
+   /* The type of the indices of a data source, and of the counts of items in its
+   interface: 32 bits wide by default, or 64 bits for a buffer of more than 2^31
+   items, e.g. DataSource<float, 0, uint64_t>; see DataSource. */
+   template<typename T> concept DataSourceIndex = std::same_as<T, uint32_t> || std::same_as<T, uint64_t>;
+
+
+   /* The size of the buffer of a data source. A size fixed at compile time (2^Z
+   items) is known to the compiler, and the buffer is then a part of the object
+   itself; see DataSource. Z = 0 stands for a size chosen at run time. */
+   template<typename ITEM, uint8_t Z, typename INDEX = uint32_t> struct DataSourceStorage
+   {
+      static_assert(Z < (( sizeof(INDEX) == 4 ) ? 32 : 48), "The buffer is too large for its indices.");
+
+      static constexpr INDEX ds_size = INDEX(1) << Z;
+
+      static constexpr INDEX ds_mask = ds_size - 1;
+
+      alignas(DS_CACHE_LINE) alignas(ITEM) byte ds_inline[sizeof(ITEM) * ds_size];
+
+      inline void setSize([[maybe_unused]] INDEX size) { assert(size == ds_size); }
+   };
+
+   template<typename ITEM, typename INDEX> struct DataSourceStorage<ITEM, 0, INDEX>
+   {
+      INDEX ds_size; 	/**< The size of the data buffer, in items; 
+      					it is always a power of two.*/
+
+      INDEX ds_mask; 	/**< The buffer size, in items, minus one; e.g. 
+      			     		the size = %00100000
+			     		the mask = %00011111 */
+
+      inline void setSize(INDEX size)
+      {
+         ds_size = size;
+         ds_mask = size - 1;
+      }
+   };
+
+
+   template<DataSourceItem ITEM, uint8_t Z = 0, DataSourceIndex INDEX = uint32_t> class DataSource
+   : private DataSourceStorage<ITEM, Z, INDEX>
+   {
+
+      private:					
+
+      using DataSourceStorage<ITEM, Z, INDEX>::ds_size;
+
+      using DataSourceStorage<ITEM, Z, INDEX>::ds_mask;
+
+      using DataSourceStorage<ITEM, Z, INDEX>::setSize;
+
+      static constexpr bool ds_trivial = std::is_trivially_copyable_v<ITEM>;
+
+      using Distance = std::make_signed_t<INDEX>;	///< A distance between two indices.
+
+      /* The release points in the tree of the readers (see ds_release_tree), and the
+      tail in ds_tail_shared, keep only the lower ds_point_bits bits of an index,
+      which leaves room above them for the flags and the versions; the rest of the
+      index is told by its distance from another one. With 64-bit indices they are
+      48 bits wide, so the buffer holds at most 2^47 items. */
+      static constexpr uint32_t ds_point_bits = ( sizeof(INDEX) == 4 ) ? 32 : 48;
+
+      static constexpr uint64_t ds_point_mask = (uint64_t(1) << ds_point_bits) - 1;
+
+      static constexpr uint64_t ds_no_reader = uint64_t(1) << ds_point_bits;	///< An empty leaf of the tree.
+
+      static constexpr uint64_t ds_release_mask = (ds_no_reader << 1) - 1;
+      					///< A release point, without the version of its node.
+
+      static constexpr uint64_t ds_node_version = ds_no_reader << 1;	///< One step of the version of a node.
+
+      static constexpr uint64_t ds_tail_epoch = ds_no_reader;	///< One step of the epoch of ds_tail_shared.
+
+      static constexpr const char * ds_file_magic = ( sizeof(INDEX) == 4 ) ? DS_FILE_MAGIC : DS_FILE_MAGIC_WIDE;
+ 
+      /* The state of a single reader. Each one occupies its own cache line(s), so
+      that readers working in different threads don't disturb each other. */
+      struct ReaderSlot
+      {
+         alignas(DS_CACHE_LINE)
+         INDEX position = 0;		/**< The "current" index of the reader, i.e. the
+         				 index of the item from which it will continue
+					 reading. It is always inside the used area. */
+
+         INDEX head_seen = 0;	/**< The reader's copy of ds_head, renewed at the
+         				 beginning of each reading session. */
+
+         atomic<INDEX> released{0};	/**< The index of the first item this reader still
+         				 needs; in the SPMC mode, its own "tail". Not used
+					 in the SPSC mode. */
+
+         uint32_t token = 0;		///< The number returned by registerDataSource().
+
+         uint32_t plane = 0;		///< The plane the reader reads from; see ds_planes.
+
+         atomic<bool> detached{false};	/**< Whether the slot is free, waiting for attachReader();
+         				 read by dataSourceStats() from any thread. */
+
+         atomic<bool> reading{false};	/**< Whether a session of the reader is in progress,
+         				 in the SPSC and SPMC modes, if the buffer may be
+					 resized; see enterSession(). */
+
+#ifdef DATA_SOURCE_STATS
+         atomic<INDEX> seen_position{0};	///< "position" as of the last stopDataSource().
+
+         atomic<uint64_t> items_read{0};
+
+         atomic<uint64_t> read_sessions{0};
+
+         atomic<uint64_t> empty_reads{0};
+
+         atomic<uint64_t> wait_ns{0};
+#endif
+
+         ReaderSlot(uint32_t t, INDEX p, uint32_t pl)
+         : position(p), head_seen(p), released(p), token(t), plane(pl)
+         {
+#ifdef DATA_SOURCE_STATS
+            seen_position.store(p, std::memory_order_relaxed);
+#endif
+         }
+
+         ReaderSlot(const ReaderSlot & o) { *this = o; }
+
+         ReaderSlot & operator=(const ReaderSlot & o)
+         {
+            position = o.position;
+            head_seen = o.head_seen;
+            released.store(o.released.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            token = o.token;
+            plane = o.plane;
+            detached.store(o.detached.load());
+#ifdef DATA_SOURCE_STATS
+            seen_position.store(o.seen_position.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            items_read.store(o.items_read.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            read_sessions.store(o.read_sessions.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            empty_reads.store(o.empty_reads.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            wait_ns.store(o.wait_ns.load(std::memory_order_relaxed), std::memory_order_relaxed);
+#endif
+            return *this;
+         }
+      };
+
+      /* The first page of the file of a file-backed data source; the planes of the
+      buffer follow it, one after another. The indices are those last published,
+      so that the data source can be opened again where it was left. */
+      struct FileHeader
+      {
+         char magic[8];			///< DS_FILE_MAGIC, written last.
+
+         uint32_t item_size;		///< sizeof(ITEM).
+
+         INDEX size;			///< ds_size.
+
+         uint32_t planes;		///< ds_planes.
+
+         uint32_t offset;		///< Where the first plane starts: the size of a page.
+
+         atomic<INDEX> head;		///< ds_head_shared.
+
+         atomic<INDEX> tail;		///< The tail, as last published.
+
+         atomic<uint64_t> sequence;	///< ds_head_sequence.
+      };
+
+      /* One temporary file of the spill queue; it holds up to "segment" items of each
+      plane, the planes one after another. */
+      struct SpillSegment
+      {
+         int fd;
+
+         INDEX written;		///< The items of each plane appended so far.
+
+         INDEX read;			///< The items of each plane moved back into the buffer.
+      };
+
+      /* The items that didn't fit into the buffer, waiting in temporary files to be
+      moved into it; see setDataSourceSpill(). Only the holder of "access" -- the
+      producer during its writing session, or else some reader that has just
+      released space -- touches the queue, or ds_head. */
+      struct Spill
+      {
+         string directory;		///< Where the temporary files are made.
+
+         INDEX limit;		///< The most items that may be spilled at a time.
+
+         INDEX segment;		///< The capacity of a file, in items of each plane.
+
+         std::deque<SpillSegment> segments;
+
+         vector<ITEM> staging;		/**< The area reserveWrite() provides when the
+         				 items are to be spilled, "staged" items for each
+					 plane. */
+
+         INDEX staged = 0;
+
+         bool reserved = false;		///< Whether reserveWrite() has provided "staging".
+
+         int error = 0;			///< The errno of a failed transfer, if any.
+
+         binary_semaphore access{1};
+
+         atomic<INDEX> spilled{0};	///< The items of each plane in "segments".
+
+         ~Spill() { for (auto & g : segments) close(g.fd); }
+      };
+
+
+      /* The limits and the state of the resizing of the buffer; see
+      setDataSourceResizing(). */
+      struct Resizing
+      {
+         INDEX min_size;		///< The size given to the constructor.
+
+         INDEX max_size;
+
+         uint32_t stalls;		///< The stalls that make the buffer grow.
+
+         std::chrono::nanoseconds idle;	/**< How long the buffer has to stay at most a
+         				 quarter full to shrink. */
+
+         uint32_t stalled = 0;		///< The stalls counted so far; see stalled().
+
+         std::chrono::steady_clock::time_point busy;
+         				/**< When the producer last stalled, or found the
+         				 buffer more than a quarter full. */
+
+         atomic<bool> resizing{false};	///< Set while the readers have to keep out.
+      };
+
+
+      ITEM * ds_buffer = nullptr;	///< The buffer for storing the data items.
+
+      uint32_t ds_planes = 1;	/**< The number of planes, i.e. of parallel buffers of ds_size
+      				 items each, that share all the indices below; see
+				 DataSourceGroup. The first one starts at ds_buffer. */
+
+      size_t ds_stride;		/**< The distance between the beginnings of two planes, in
+      				 items; more than ds_size once the buffer has shrunk. */
+
+      uint8_t ds_mode;		///< DS_LOCKED, DS_SPSC or DS_SPMC.
+
+      bool ds_mirrored = false;	/**< Whether the buffer is followed by its mirror image
+      				 in the virtual memory; see allocateBuffer(). */
+
+      uint8_t ds_memory = 0;	///< The options for the memory of the buffer (DS_MEMORY_MASK).
+
+      size_t ds_huge = 0;	///< The length of the mapping of huge pages, if the buffer is one.
+
+      bool ds_memlocked = false;	///< Whether the buffer is locked into the memory.
+
+      FileHeader * ds_file = nullptr;	/**< The header of the file the buffer is mapped
+      				 from, if any; see the file-backed constructor. */
+
+      int ds_fd = -1;		///< The file, locked as long as it is mapped.
+
+      std::unique_ptr<Spill> ds_spill;	///< The overflow to disk, if it is enabled.
+
+      std::unique_ptr<Resizing> ds_resizing;	///< The resizing of the buffer, if it is enabled.
+
+      binary_semaphore ds_access{1};
+
+      /* All the indices below are running counts of data items: they are never
+      wrapped around, and only masked by ds_mask when the buffer is accessed.
+      Hence the number of items between two of them is always a plain difference,
+      and an empty buffer can't be confused with a full one. */
+
+
+      // The producer's side
+      // -------------------------------------------------------------------------------------
+
+      alignas(DS_CACHE_LINE)
+      INDEX ds_head = 0; 	/**< The index of the position immediately after the used area.*/
+
+      INDEX ds_tail_seen = 0;	/**< The producer's copy of ds_tail, renewed at the
+      				 beginning of each writing session. */
+
+      bool ds_more = true; 	/**< Whether this object will produce more data,
+      				 beside what's currently in the buffer. */
+
+      bool ds_writing = false;	///< Whether a writing session is in progress.
+
+      INDEX ds_reserved = 0;	///< The length of the area handed out by reserveWrite().
+
+      atomic<uint32_t> ds_pinned{0};	///< The pins that keep the buffer from being resized.
+
+      INDEX ds_destroyed = 0;	/**< Unless the items are trivially copyable: the
+      				 index up to which those released have been
+				 destroyed; see releaseItems(). */
+
+
+      // The readers' side
+      // -------------------------------------------------------------------------------------
+
+      alignas(DS_CACHE_LINE)
+      INDEX ds_tail = 0; 	/**< The index of the first position in the used area.
+      				 Not used in the SPMC mode, where each reader has its own.*/
+
+      std::deque<ReaderSlot> ds_reader_position = { };
+      				/**< The state of each reader, including its "current"
+				 index. Adding readers doesn't move the others, so
+				 their views stay valid. */
+
+      vector<uint32_t> ds_free_slots;	///< The slots of the detached readers, for reuse.
+
+      ReaderSlot * ds_current = nullptr;
+      				/**< Points to the state of the current reader. */
+
+      atomic<atomic<uint64_t>*> ds_release_tree{nullptr};
+      				/**< A tournament tree of the readers' "released"
+				 indices. Node 0 holds the number of leaves L, a
+				 power of two; reader n's leaf is node L + n, and
+				 each inner node n holds the lower of its children
+				 2n and 2n + 1, so that the root, node 1, holds the
+				 lowest of all. Empty leaves hold ds_no_reader. Above
+				 ds_release_mask, each inner node counts its changes. */
+
+      vector<std::unique_ptr<atomic<uint64_t>[]>> ds_release_trees;
+      				/**< The storage of the trees: the last one is
+				 ds_release_tree, and the earlier ones are kept as
+				 long as some reader may still be updating them. */
+
+      binary_semaphore ds_attach{1};	///< Taken by attachReader() and detachReader().
+
+      mutable binary_semaphore ds_slots{1};	/**< Taken while a slot is added to
+      					 ds_reader_position by attachReader(), and by
+      					 dataSourceStats() while it walks the slots; no
+      					 other lock is taken meanwhile. */
+
+
+      // The indices passed from one side to the other
+      // -------------------------------------------------------------------------------------
+
+      alignas(DS_CACHE_LINE)
+      atomic<INDEX> ds_head_shared{0};	///< ds_head, as published by the producer.
+
+      atomic<uint64_t> ds_head_sequence{0};	/**< The number of items ever published, whose
+      				 lower half is ds_head_shared; stored before it,
+				 so that it is never behind. See sequenceOf(). */
+
+      atomic<bool> ds_finished{false};	/**< ds_more negated, published after the last
+      				 ds_head. */
+
+      alignas(DS_CACHE_LINE)
+      atomic<uint64_t> ds_tail_shared{0};	/**< ds_tail, as published by the readers, in the
+      				 lower ds_point_bits bits; see sharedTail(). In the
+				 SPMC mode, the bits above are changed whenever a
+				 reader is attached; see attachSlot(). */
+
+
+      // The threads sleeping in waitReadable() and waitWritable()
+      // -------------------------------------------------------------------------------------
+
+      alignas(DS_CACHE_LINE)
+      atomic<uint32_t> ds_readable_event{0};	/**< Changed whenever the sleeping readers are
+      				 woken; they sleep on it as on a futex. */
+
+      atomic<uint32_t> ds_readers_waiting{0};	///< The number of readers in waitReadable().
+
+      atomic<uint32_t> ds_writable_event{0};	///< The same as ds_readable_event, for the producer.
+
+      atomic<uint32_t> ds_producer_waiting{0};	///< Whether the producer is in waitWritable().
+
+      INDEX ds_high_watermark = 1;	/**< The number of items in the buffer that makes
+      				 it worth waking the sleeping readers. */
+
+      INDEX ds_low_watermark;	/**< The number of items in the buffer that must not
+      				 be exceeded for the sleeping producer to be woken. */
+
+
+#ifdef DATA_SOURCE_STATS
+      // The producer's counters; each counter has a single writer, so they are
+      // only loaded and stored, never locked.
+      // -------------------------------------------------------------------------------------
+
+      alignas(DS_CACHE_LINE)
+      atomic<uint64_t> ds_items_written{0};
+
+      atomic<uint64_t> ds_write_sessions{0};
+
+      atomic<uint64_t> ds_write_stalls{0};
+
+      atomic<uint64_t> ds_write_wait_ns{0};
+
+      atomic<INDEX> ds_high_water{0};
+#endif
+
+
+#ifdef VERBOSE_DATA_SOURCE
+      string ds_name;	
+
+      char ds_state[512];
+#endif 
+
+
+      //**************************************************************************************
+
+#ifdef DATA_SOURCE_STATS
+      /** Adds to a counter that only the calling thread changes. */
+      template<typename T> static inline void count(atomic<T> & counter, T amount)
+      {
+         counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+      }
+#endif
+
+
+      //**************************************************************************************
+
+      /** Waits for the buffer to be released, in the DS_LOCKED mode; with the counters
+      on, the time spent waiting is added to "waited". */
+      inline void acquireAccess([[maybe_unused]] atomic<uint64_t> * waited)
+      {
+#ifdef DATA_SOURCE_STATS
+         if ( ds_access.try_acquire() ) return;
+
+         auto start = std::chrono::steady_clock::now();
+         ds_access.acquire();
+         if ( waited != nullptr )
+            count<uint64_t>(*waited, std::chrono::duration_cast<std::chrono::nanoseconds>(
+         			std::chrono::steady_clock::now() - start).count());
+#else
+         ds_access.acquire();
+#endif
+      }
+
+
+      //**************************************************************************************
+
+      /** The first item still needed by the reader: its own "tail" in the SPMC mode,
+      and the common one otherwise. */
+      inline INDEX tailFor(ReaderSlot & r)
+      {
+         return ( ds_mode == DS_SPMC ) ? r.released.load(std::memory_order_relaxed) : ds_tail;
+      }
+
+
+      //**************************************************************************************
+
+      /** The sequence number of the item at the given index, which may be anywhere
+      from the tail up to the head, as published. 32-bit indices are the lower
+      halves of the sequence numbers, and no two items in the buffer are 2^32
+      apart, so the distance from the published head settles it; 64-bit indices
+      are the sequence numbers themselves. */
+      inline uint64_t sequenceOf(INDEX index) const
+      {
+         uint64_t head = ds_head_sequence.load(std::memory_order_acquire);
+
+         return head - INDEX(INDEX(head) - index);
+      }
+
+
+      //**************************************************************************************
+
+      /** The lower ds_point_bits bits of an index, as the tree of the readers and
+      ds_tail_shared keep them. */
+      static inline uint64_t pointOf(INDEX index) { return index & ds_point_mask; }
+
+      /** The distance from one release point, or tail, to another, which may be
+      negative; only their lower ds_point_bits bits count. */
+      static inline int64_t pointDistance(uint64_t from, uint64_t to)
+      {
+         constexpr uint32_t shift = 64 - ds_point_bits;
+
+         return int64_t((to - from) << shift) >> shift;
+      }
+
+      /** The index nearest to "near" whose lower bits are the given point. */
+      static inline INDEX fromPoint(uint64_t point, INDEX near)
+      {
+         return near + INDEX(pointDistance(near, point));
+      }
+
+      /** The tail as published, told from its lower bits in ds_tail_shared by the
+      head as published, which is never behind it. */
+      inline INDEX sharedTail() const
+      {
+         uint64_t tail = ds_tail_shared.load(std::memory_order_acquire);
+
+         return fromPoint(tail, ds_head_shared.load(std::memory_order_acquire));
+      }
+
+
+      //**************************************************************************************
+
+      /** The size of the continuous used area starting from the "ds_current" marker,
+      that is, the area terminated either by the "ds_head" marker or by the end of
+      the buffer -- whichever is encountered first. */
+      inline INDEX continuousUsed(ReaderSlot & r)
+      {
+         INDEX used = ahead(r);
+         if ( ds_mirrored ) return used;
+
+         INDEX toEnd = ds_size - (r.position & ds_mask);
+      
+         return (used < toEnd) ? used : toEnd;
+      }
+
+
+      //**************************************************************************************
+
+      /** The size of the continuous free area starting from the "ds_head" marker,
+      that is, the area terminated either by the end of the buffer or by the
+      "ds_tail" marker -- whichever is encountered first. */
+      inline INDEX continuousFree()
+      {
+         INDEX free = ringFree();
+         if ( ds_mirrored ) return free;
+
+         INDEX toEnd = ds_size - (ds_head & ds_mask);
+      
+         return (free < toEnd) ? free : toEnd;
+      }
+
+
+      //**************************************************************************************
+
+      /** The number of data items in the buffer ahead of the "ds_current" marker. It
+      is supposed to be used by the single reader of this object before it starts
+      reading a fresh amount of data from the buffer. */
+      inline INDEX ahead(ReaderSlot & r) { return r.head_seen - r.position; }
+
+      inline INDEX ahead() { return ahead(*ds_current); }
+
+
+      //**************************************************************************************
+
+      /** The number of data items in the buffer behind the "ds_current" marker, i.e.
+      those that have already been read, but not released yet. */
+      inline INDEX behind(ReaderSlot & r) { return r.position - tailFor(r); }
+
+
+      //**************************************************************************************
+
+      /** Obtains the memory for ds_planes buffers of ds_size items. With the DS_MIRRORED
+      option, the same memory (a memfd object) is mapped twice, one copy right after
+      the other, so that any region of up to ds_size items starting anywhere in the
+      buffer is contiguous. As a mapping consists of whole pages, ds_size is doubled
+      until the buffer fills whole pages. If the mapping fails for any reason, the
+      buffer is allocated in the ordinary way. Given a file, the buffer is mapped
+      from it instead, after the header page, mirrored or not; it is then an error
+      if that fails. Finally the options in ds_memory are applied; see
+      settleBuffer(). */
+      bool allocateBuffer(bool mirrored, int file = -1)
+      {
+         ds_mirrored = false;
+         mirrored = mirrored && ds_trivial;	// An object lives at one address only.
+
+         if constexpr ( Z != 0 ) {
+            ds_buffer = reinterpret_cast<ITEM*>(this->ds_inline);
+            ds_stride = ds_size;
+            return true;
+         }
+
+         size_t page = sysconf(_SC_PAGESIZE);
+         off_t offset = ( file >= 0 ) ? page : 0;
+
+         if ( mirrored ) {
+            while ( (size_t(ds_size) * sizeof(ITEM)) % page ) setSize(ds_size << 1);
+
+            size_t bytes = size_t(ds_size) * sizeof(ITEM);
+            int fd = ( file >= 0 ) ? file : memfd_create("DataSource", MFD_CLOEXEC);
+
+            if ( fd >= 0 && ftruncate(fd, offset + ds_planes * bytes) == 0 ) {
+               void * area = mmap(nullptr, 2 * ds_planes * bytes, PROT_NONE,
+               					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+               if ( area != MAP_FAILED ) {
+                  bool mapped = true;
+
+                  for (uint32_t p = 0; mapped && p < ds_planes; p++) {
+                     byte * lower = reinterpret_cast<byte*>(area) + 2 * p * bytes;
+
+                     mapped = mmap(lower, bytes, PROT_READ | PROT_WRITE,
+                  		MAP_SHARED | MAP_FIXED, fd, offset + p * bytes) != MAP_FAILED &&
+                              mmap(lower + bytes, bytes, PROT_READ | PROT_WRITE,
+                       		MAP_SHARED | MAP_FIXED, fd, offset + p * bytes) != MAP_FAILED;
+                  }
+                  if ( mapped ) {
+                     ds_buffer = reinterpret_cast<ITEM*>(area);
+                     ds_mirrored = true;
+                  }
+                  else munmap(area, 2 * ds_planes * bytes);
+               }
+            }
+            if ( fd >= 0 && fd != file ) close(fd);
+         }
+
+         if ( !ds_mirrored && file >= 0 ) {
+            size_t bytes = size_t(ds_size) * sizeof(ITEM);
+            void * area = MAP_FAILED;
+
+            if ( ftruncate(file, offset + ds_planes * bytes) == 0 )
+               area = mmap(nullptr, ds_planes * bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, offset);
+            ds_buffer = ( area != MAP_FAILED ) ? reinterpret_cast<ITEM*>(area) : nullptr;
+         }
+         else if ( !ds_mirrored ) {
+            size_t bytes = ds_planes * size_t(ds_size) * sizeof(ITEM);
+
+            if ( ds_memory & DS_HUGE_PAGES ) allocateHuge(bytes);
+
+            // Whole pages, if it is that large, so that e.g. O_DIRECT may use it.
+            if ( ds_buffer == nullptr ) {
+               size_t align = ( bytes >= page ) ? page : DS_CACHE_LINE;
+
+               ds_buffer = reinterpret_cast<ITEM*>(aligned_alloc(align, (bytes + align - 1) / align * align));
+            }
+         }
+         ds_stride = ds_mirrored ? 2 * size_t(ds_size) : ds_size;
+
+         if ( ds_buffer == nullptr ) return false;
+
+         settleBuffer();
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Maps the buffer from huge pages: from the reserved ones (MAP_HUGETLB) if there
+      are any, and otherwise from an area aligned to DS_HUGE_PAGE, which the kernel is
+      asked to back with transparent huge pages. Leaves ds_buffer null if both fail. */
+      void allocateHuge(size_t bytes)
+      {
+         size_t length = (bytes + DS_HUGE_PAGE - 1) / DS_HUGE_PAGE * DS_HUGE_PAGE;
+
+         void * area = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+         			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+         if ( area == MAP_FAILED ) {
+            byte * wide = reinterpret_cast<byte*>(mmap(nullptr, length + DS_HUGE_PAGE,
+            			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if ( wide == MAP_FAILED ) return;
+
+            // Only the aligned part is kept.
+            byte * aligned = wide + (DS_HUGE_PAGE - reinterpret_cast<uintptr_t>(wide) % DS_HUGE_PAGE) % DS_HUGE_PAGE;
+            if ( aligned > wide ) munmap(wide, aligned - wide);
+            munmap(aligned + length, wide + length + DS_HUGE_PAGE - (aligned + length));
+            madvise(aligned, length, MADV_HUGEPAGE);
+            area = aligned;
+         }
+
+         ds_buffer = reinterpret_cast<ITEM*>(area);
+         ds_huge = length;
+      }
+
+
+      //**************************************************************************************
+
+      /** Applies DS_PREFAULT and DS_MLOCKED to the buffer just obtained. Locking the
+      buffer faults it in too; should it fail (e.g. for RLIMIT_MEMLOCK), the buffer
+      is only faulted in, and dataSourceMemoryLocked() tells so. */
+      void settleBuffer()
+      {
+         size_t bytes = ds_planes * ds_stride * sizeof(ITEM);
+
+         if ( ds_memory & DS_MLOCKED ) ds_memlocked = mlock(ds_buffer, bytes) == 0;
+         if ( (ds_memory & (DS_PREFAULT | DS_MLOCKED)) && !ds_memlocked ) prefaultDataSource();
+      }
+
+
+      //**************************************************************************************
+
+      /** Gives back the memory obtained by allocateBuffer(), and the file, if any. */
+      void releaseBuffer()
+      {
+         if ( ds_buffer != nullptr ) releaseItems(ds_head);
+
+         if constexpr ( Z != 0 ) {
+            ds_buffer = nullptr;
+            return;
+         }
+
+         if ( ds_file != nullptr ) {
+            munmap(ds_file, sysconf(_SC_PAGESIZE));
+            ds_file = nullptr;
+         }
+
+         if ( ds_buffer != nullptr ) {
+            if ( ds_memlocked ) munlock(ds_buffer, ds_planes * ds_stride * sizeof(ITEM));
+            if ( ds_mirrored || ds_fd >= 0 ) munmap(ds_buffer, ds_planes * ds_stride * sizeof(ITEM));
+            else if ( ds_huge ) munmap(ds_buffer, ds_huge);
+            else free(ds_buffer);
+            ds_buffer = nullptr;
+            ds_huge = 0;
+            ds_memlocked = false;
+         }
+
+         if ( ds_fd >= 0 ) {
+            close(ds_fd);
+            ds_fd = -1;
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** Moves the items from "first" up to "last" from one layout of a plane to
+      another, each at its index masked by the mask of the layout; items that
+      aren't trivially copyable are moved into place and destroyed where they
+      were. The two may be the same area, when no item still needed lies where
+      another one goes. */
+      static void moveItems(ITEM * from, INDEX fromMask, ITEM * to, INDEX toMask,
+      					INDEX first, INDEX last)
+      {
+         for (INDEX i = first; i != last; ) {
+            INDEX n = last - i;
+            if ( n > fromMask + 1 - (i & fromMask) ) n = fromMask + 1 - (i & fromMask);
+            if ( n > toMask + 1 - (i & toMask) ) n = toMask + 1 - (i & toMask);
+
+            if constexpr ( ds_trivial ) memmove(to + (i & toMask), from + (i & fromMask), n * sizeof(ITEM));
+            else if ( to + (i & toMask) != from + (i & fromMask) ) {
+               std::uninitialized_move_n(from + (i & fromMask), n, to + (i & toMask));
+               std::destroy_n(from + (i & fromMask), n);
+            }
+            i += n;
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** Destroys the items from ds_destroyed up to the given index, once the readers
+      have released them, unless they are trivially copyable. It is up to the
+      producer, so that a slot isn't written before the item that was there is
+      gone; thus the items stay until its next writing session. */
+      void releaseItems(INDEX tail)
+      {
+         if constexpr ( !ds_trivial ) {
+            for (uint32_t p = 0; p < ds_planes; p++)
+               for (INDEX i = ds_destroyed; i != tail; i++) std::destroy_at(planeBuffer(p) + (i & ds_mask));
+            ds_destroyed = tail;
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** Makes the buffer hold "size" items. The indices don't change, so each reader
+      stays where it was; only the items from the tail up to the head move to where
+      the new mask puts them. Within the area allocated already (ds_stride items of
+      each plane), they are moved in place, and the whole pages a smaller buffer
+      leaves unused are given back to the kernel; a larger buffer gets a new area,
+      unless that fails, in which case the buffer stays as it was. In the DS_LOCKED
+      mode the producer holds the buffer meanwhile; in the others, it waits until
+      no reader is in a session, while the readers starting one wait for it. Nothing
+      is done, and false returned, while the buffer is pinned; see pinDataSource(). */
+      bool resizeBuffer(INDEX size)
+      {
+         Resizing & e = *ds_resizing;
+         bool locked = ( ds_mode == DS_LOCKED && !ds_writing );
+
+         if ( ds_pinned.load() ) return false;
+
+#ifdef DATA_SOURCE_STATS
+         if ( locked ) acquireAccess(&ds_write_wait_ns);
+#else
+         if ( locked ) acquireAccess(nullptr);
+#endif
+         if ( ds_mode != DS_LOCKED ) {
+            ds_attach.acquire();
+            e.resizing.store(true);
+            for (auto & r : ds_reader_position) r.reading.wait(true);
+         }
+
+         // A reader pins the buffer within its sessions, which are all over now.
+         if ( ds_pinned.load() ) {
+            if ( ds_mode != DS_LOCKED ) {
+               e.resizing.store(false);
+               e.resizing.notify_all();
+               ds_attach.release();
+            }
+            if ( locked ) ds_access.release();
+            return false;
+         }
+
+         INDEX tail = ( ds_mode == DS_SPMC ) ? fromPoint(ds_tail_shared.load(), ds_head) : ds_tail;
+         INDEX old = ds_size;
+         assert(ds_head - tail <= size);
+         releaseItems(tail);
+
+         if ( size <= ds_stride ) {
+            for (uint32_t p = 0; p < ds_planes; p++)
+               moveItems(planeBuffer(p), ds_mask, planeBuffer(p), size - 1, tail, ds_head);
+            setSize(size);
+
+            if ( size < old ) {
+               size_t page = sysconf(_SC_PAGESIZE);
+
+               for (uint32_t p = 0; p < ds_planes; p++) {
+                  uintptr_t start = reinterpret_cast<uintptr_t>(planeBuffer(p) + size);
+                  uintptr_t end = reinterpret_cast<uintptr_t>(planeBuffer(p) + old);
+                  start = (start + page - 1) / page * page;
+                  end = end / page * page;
+                  if ( start >= end ) continue;
+
+                  if ( ds_memlocked ) munlock(reinterpret_cast<void*>(start), end - start);
+                  madvise(reinterpret_cast<void*>(start), end - start, MADV_DONTNEED);
+               }
+            }
+            else if ( ds_memory & (DS_PREFAULT | DS_MLOCKED) ) settleBuffer();
+         }
+         else {
+            ITEM * buffer = ds_buffer;
+            size_t stride = ds_stride, huge = ds_huge;
+            bool memlocked = ds_memlocked;
+
+            ds_buffer = nullptr;
+            ds_huge = 0;
+            ds_memlocked = false;
+            setSize(size);
+
+            if ( allocateBuffer(false) ) {
+               for (uint32_t p = 0; p < ds_planes; p++)
+                  moveItems(buffer + p * stride, old - 1, planeBuffer(p), ds_mask, tail, ds_head);
+
+               if ( memlocked ) munlock(buffer, ds_planes * stride * sizeof(ITEM));
+               if ( huge ) munmap(buffer, huge);
+               else free(buffer);
+            } else {
+               ds_buffer = buffer;
+               ds_stride = stride;
+               ds_huge = huge;
+               ds_memlocked = memlocked;
+               setSize(old);
+            }
+         }
+
+         // A low watermark left at the size keeps waking the producer at every release.
+         if ( ds_high_watermark > ds_size ) ds_high_watermark = ds_size;
+         if ( ds_low_watermark > ds_size || ds_low_watermark == old ) ds_low_watermark = ds_size;
+
+         if ( ds_mode != DS_LOCKED ) {
+            e.resizing.store(false);
+            e.resizing.notify_all();
+            ds_attach.release();
+         }
+         if ( locked ) ds_access.release();
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Counts a stall of the producer: a writing session that began with the
+      buffer at least 7/8 full, or a wait in waitWritable(). The buffer grows once
+      there have been so many, none of them an idle time after the previous one.
+      Returns whether it has grown. */
+      bool stalled(std::chrono::steady_clock::time_point now)
+      {
+         Resizing & e = *ds_resizing;
+
+         if ( now - e.busy > e.idle ) e.stalled = 0;
+         e.busy = now;
+
+         if ( ++e.stalled < e.stalls || ds_size >= e.max_size ) return false;
+
+         if ( !resizeBuffer(2 * ds_size) ) return false;
+         e.stalled = 0;
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Decides, at the beginning of a writing session, whether the buffer should
+      grow, or shrink: it does the latter once it has held no more than a quarter of
+      its size for the idle time. */
+      void adaptBuffer()
+      {
+         Resizing & e = *ds_resizing;
+         INDEX used = ds_head - ds_tail_seen;
+         auto now = std::chrono::steady_clock::now();
+
+         if ( used >= ds_size - ds_size / 8 ) stalled(now);
+         else if ( used > ds_size / 4 ) e.busy = now;
+         else if ( ds_size > e.min_size && now - e.busy >= e.idle ) {
+            resizeBuffer(ds_size / 2);
+            e.busy = now;
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /* The reader's side of resizing, in the SPSC and SPMC modes: a session is let
+      in only while the buffer isn't being resized. */
+
+      void enterSession(ReaderSlot & r)
+      {
+         Resizing & e = *ds_resizing;
+
+         r.reading.store(true);
+         while ( e.resizing.load() ) {
+            r.reading.store(false);
+            r.reading.notify_all();
+            e.resizing.wait(true);
+            r.reading.store(true);
+         }
+      }
+
+      void leaveSession(ReaderSlot & r)
+      {
+         r.reading.store(false);
+         if ( ds_resizing->resizing.load() ) r.reading.notify_all();
+      }
+
+
+      //**************************************************************************************
+
+      /** Opens the file of a file-backed data source, making it if it doesn't exist
+      yet, and maps the buffer from it; see the file-backed constructor. Whatever
+      has been obtained is given back if anything fails. */
+      void openFile(const char * path, bool mirrored)
+      {
+         size_t page = sysconf(_SC_PAGESIZE);
+         struct stat st;
+
+         ds_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+         if ( ds_fd < 0 || flock(ds_fd, LOCK_EX | LOCK_NB) != 0 || fstat(ds_fd, &st) != 0 ||
+              ( size_t(st.st_size) < page && ftruncate(ds_fd, page) != 0 ) )
+            fileError(DSEXC_B_FILE, strerror(errno));
+
+         void * header = mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED, ds_fd, 0);
+         if ( header == MAP_FAILED ) fileError(DSEXC_B_FILE, strerror(errno));
+         ds_file = reinterpret_cast<FileHeader*>(header);
+
+         // A file whose header was never completed is made anew.
+         bool fresh = ds_file->magic[0] == 0;
+         if ( !fresh ) {
+            INDEX size = ds_file->size;
+
+            if ( memcmp(ds_file->magic, ds_file_magic, sizeof(ds_file->magic)) != 0 ||
+                 ds_file->item_size != sizeof(ITEM) || ds_file->planes != ds_planes ||
+                 ds_file->offset != page || size == 0 || (size & (size - 1)) != 0 ||
+                 size_t(st.st_size) < page + size_t(ds_planes) * size * sizeof(ITEM) )
+               fileError(DSEXC_B_FILE_FORMAT, path);
+
+            setSize(size);
+            mirrored = mirrored && (size_t(size) * sizeof(ITEM)) % page == 0;
+         }
+         else ds_file->offset = page;
+
+         if ( !allocateBuffer(mirrored, ds_fd) ) fileError(DSEXC_B_FILE, strerror(errno));
+
+         if ( fresh ) {
+            ds_file->item_size = sizeof(ITEM);
+            ds_file->size = ds_size;
+            ds_file->planes = ds_planes;
+            ds_file->head.store(0);
+            ds_file->tail.store(0);
+            ds_file->sequence.store(0);
+            memcpy(ds_file->magic, ds_file_magic, sizeof(ds_file->magic));
+            return;
+         }
+
+         INDEX head = ds_file->head.load(), tail = ds_file->tail.load();
+         if ( head - tail > ds_size ) fileError(DSEXC_B_FILE_FORMAT, path);
+
+         ds_head = head;
+         ds_tail = ds_tail_seen = tail;
+         ds_head_shared.store(head);
+         ds_tail_shared.store(tail);
+
+         // A file written before the sequence was kept in it goes on from the head.
+         uint64_t sequence = ds_file->sequence.load();
+         ds_head_sequence.store(( INDEX(sequence) == head ) ? sequence : head);
+      }
+
+
+      //**************************************************************************************
+
+      /** Gives back whatever openFile() has obtained, and throws the exception. */
+      [[noreturn]] void fileError(uint8_t brief, const char * message)
+      {
+         DataSourceException e(brief, DSEXC_M_CONSTR_FILE, DSEXC_A_MAP_FILE, message);
+
+         releaseBuffer();
+         throw e;
+      }
+
+
+      //**************************************************************************************
+
+      /** The beginning of the given plane of the buffer. */
+      inline ITEM * planeBuffer(uint32_t p)
+      {
+         if constexpr ( Z != 0 ) return reinterpret_cast<ITEM*>(this->ds_inline);
+         else return ds_buffer + p * ds_stride;
+      }
+
+
+      //**************************************************************************************
+
+      /** The point in time "timeout" from now; the farthest possible one for DS_FOREVER. */
+      static std::chrono::steady_clock::time_point deadlineAfter(std::chrono::nanoseconds timeout)
+      {
+         auto now = std::chrono::steady_clock::now();
+
+         if ( timeout >= std::chrono::steady_clock::time_point::max() - now )
+            return std::chrono::steady_clock::time_point::max();
+
+         return now + timeout;
+      }
+
+
+      //**************************************************************************************
+
+      /** Puts the calling thread to sleep until "event" is no longer equal to "seen",
+      or until the deadline passes; returns false in the latter case. It may also
+      return earlier, so the caller has to check again what it is waiting for. */
+      static bool sleepOn(atomic<uint32_t> & event, uint32_t seen,
+      				std::chrono::steady_clock::time_point deadline)
+      {
+         static_assert(sizeof(atomic<uint32_t>) == sizeof(uint32_t));
+
+         timespec t, * timeout = nullptr;
+
+         if ( deadline != std::chrono::steady_clock::time_point::max() ) {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            				deadline - std::chrono::steady_clock::now()).count();
+            if ( left <= 0 ) return false;
+
+            t.tv_sec = left / 1000000000;
+            t.tv_nsec = left % 1000000000;
+            timeout = &t;
+         }
+
+         syscall(SYS_futex, reinterpret_cast<uint32_t*>(&event), FUTEX_WAIT_PRIVATE, seen,
+         						timeout, nullptr, 0);
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Wakes all the threads sleeping on "event". */
+      static void wakeAll(atomic<uint32_t> & event)
+      {
+         event.fetch_add(1, std::memory_order_release);
+         syscall(SYS_futex, reinterpret_cast<uint32_t*>(&event), FUTEX_WAKE_PRIVATE, INT_MAX,
+         						nullptr, nullptr, 0);
+      }
+
+
+      //**************************************************************************************
+
+      /** Makes the items written so far visible to the readers; in the SPSC mode
+      this is the only point where the producer and the reader meet. The readers
+      sleeping in waitReadable() are woken once the buffer holds enough items to
+      be worth it, or when there will be no more. While items wait in the spill
+      queue, the producer hasn't finished yet. */
+      inline void publishHead()
+      {
+#ifdef DATA_SOURCE_STATS
+         count<uint64_t>(ds_items_written, ds_head - ds_head_shared.load(std::memory_order_relaxed));
+         if ( ds_head - ds_tail_seen > ds_high_water.load(std::memory_order_relaxed) )
+            ds_high_water.store(ds_head - ds_tail_seen, std::memory_order_relaxed);
+#endif
+         uint64_t sequence = ds_head_sequence.load(std::memory_order_relaxed);
+         sequence += INDEX(ds_head - INDEX(sequence));
+         ds_head_sequence.store(sequence, std::memory_order_relaxed);
+         ds_head_shared.store(ds_head, std::memory_order_release);
+         if ( ds_file != nullptr ) {
+            ds_file->sequence.store(sequence, std::memory_order_relaxed);
+            ds_file->head.store(ds_head, std::memory_order_release);
+         }
+
+         bool last = !ds_more && ( ds_spill == nullptr || !ds_spill->spilled.load(std::memory_order_relaxed) );
+         if ( last ) ds_finished.store(true, std::memory_order_release);
+
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         if ( ds_readers_waiting.load(std::memory_order_relaxed) &&
+         	( last || ds_head - ds_tail_seen >= ds_high_watermark ) )
+            wakeAll(ds_readable_event);
+      }
+
+
+      //**************************************************************************************
+
+      /** Called after the readers have published a new "tail"; wakes the producer
+      sleeping in waitWritable() once few enough items are left in the buffer. The
+      tail kept in the file, if any, only moves forward, even though in the SPMC
+      mode two readers may get here in either order. */
+      inline void publishedTail(INDEX tail)
+      {
+         if ( ds_file != nullptr ) {
+            INDEX saved = ds_file->tail.load(std::memory_order_relaxed);
+            while ( Distance(tail - saved) > 0 &&
+            	!ds_file->tail.compare_exchange_weak(saved, tail, std::memory_order_release) ) { }
+         }
+
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         if ( ds_producer_waiting.load(std::memory_order_relaxed) &&
+         	ds_head_shared.load(std::memory_order_relaxed) - tail <= ds_low_watermark )
+            wakeAll(ds_writable_event);
+
+         // The space released goes to the spilled items first, unless the producer
+         // is at it anyway.
+         if ( ds_spill != nullptr && ds_spill->spilled.load(std::memory_order_relaxed) &&
+              ds_spill->access.try_acquire() ) {
+            ds_tail_seen = fromPoint(ds_tail_shared.load(std::memory_order_acquire), ds_head);
+            drainSpill();
+            publishHead();
+            releaseSpill();
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** The free area of the buffer itself, in data items. */
+      inline INDEX ringFree() { return ds_size - (ds_head - ds_tail_seen); }
+
+
+
+      //**************************************************************************************
+
+      /** How many more items may be spilled now; zero if spilling isn't enabled. */
+      inline INDEX spillRoom() const
+      {
+         return ( ds_spill != nullptr ) ?
+         	ds_spill->limit - ds_spill->spilled.load(std::memory_order_relaxed) : 0;
+      }
+
+
+      //**************************************************************************************
+
+      /** Reads or writes a whole region of a file, at the given offset or, if it is
+      negative, at the current position, however many calls it takes; a non-blocking
+      descriptor is waited for. Returns false, and keeps errno, on failure. */
+      static bool transferAll(bool writing, int fd, void * data, size_t bytes, off_t offset)
+      {
+         byte * p = reinterpret_cast<byte*>(data);
+
+         while ( bytes ) {
+            ssize_t done = ( offset < 0 ) ?
+            		( writing ? write(fd, p, bytes) : read(fd, p, bytes) ) :
+            		( writing ? pwrite(fd, p, bytes, offset) : pread(fd, p, bytes, offset) );
+            if ( done < 0 && errno == EINTR ) continue;
+            if ( done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+               pollfd ready = { fd, short(writing ? POLLOUT : POLLIN), 0 };
+               if ( poll(&ready, 1, -1) >= 0 || errno == EINTR ) continue;
+            }
+            if ( done <= 0 ) {
+               if ( done == 0 ) errno = EIO;
+               return false;
+            }
+            p += done;
+            if ( offset >= 0 ) offset += done;
+            bytes -= done;
+         }
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Throws the error of a transfer to or from a file descriptor. */
+      [[noreturn]] static void transferFailed(bool writing, uint8_t method, int error)
+      {
+         throw DataSourceException(DSEXC_B_FD, method,
+         		writing ? DSEXC_A_COPY_DATA : DSEXC_A_READ_DATA, strerror(error));
+      }
+
+
+      //**************************************************************************************
+
+      /** Moves the items of a region of the buffer, which may be split in two, to or
+      from a file descriptor with a single writev() or readv() call (pwritev() or
+      preadv() at the given offset, unless it is negative). Should the call stop
+      within an item, the rest of that item is moved by further calls, waiting for a
+      non-blocking descriptor if need be, so that a stream stays aligned. Returns the
+      number of whole items moved, which may be fewer than asked for; EAGAIN counts
+      as nothing moved, while any other error is thrown. If the rest of a split item
+      can't be moved, the end of the file included, the whole items before it are
+      still returned, and the error is left in "error" for the caller to throw with
+      transferFailed() once it has taken them. */
+      static INDEX transferItems(bool writing, int fd, ITEM * first, INDEX firstLength,
+      				ITEM * second, INDEX secondLength, off_t offset, uint8_t method,
+      				int & error)
+      {
+         iovec io[2] = { { first, firstLength * sizeof(ITEM) }, { second, secondLength * sizeof(ITEM) } };
+         int count = secondLength ? 2 : 1;
+         ssize_t done;
+
+         do {
+            done = ( offset < 0 ) ?
+            	( writing ? writev(fd, io, count) : readv(fd, io, count) ) :
+            	( writing ? pwritev(fd, io, count, offset) : preadv(fd, io, count, offset) );
+         } while ( done < 0 && errno == EINTR );
+
+         error = 0;
+         if ( done < 0 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) return 0;
+            transferFailed(writing, method, errno);
+         }
+
+         // The regions consist of whole items, so a split item lies in one of them.
+         size_t split = done % sizeof(ITEM);
+         if ( split ) {
+            byte * rest = ( size_t(done) < io[0].iov_len ) ?
+            		reinterpret_cast<byte*>(first) + done :
+            		reinterpret_cast<byte*>(second) + (done - io[0].iov_len);
+
+            if ( transferAll(writing, fd, rest, sizeof(ITEM) - split, ( offset < 0 ) ? -1 : offset + done) )
+               done += sizeof(ITEM) - split;
+            else error = errno;
+         }
+
+         return done / sizeof(ITEM);
+      }
+
+
+      //**************************************************************************************
+
+      /** Appends "length" items of each plane to the spill queue; the items of plane p
+      start at src + p * stride. Makes a new temporary file whenever the last one is
+      full. Returns false on failure, with the error kept in ds_spill. */
+      bool appendSpill(const ITEM * src, size_t stride, INDEX length)
+      {
+         Spill & sp = *ds_spill;
+
+         while ( length ) {
+            if ( sp.segments.empty() || sp.segments.back().written == sp.segment ) {
+               int fd = open(sp.directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+
+               if ( fd < 0 ) {
+                  string name = sp.directory + "/DataSourceXXXXXX";
+                  fd = mkostemp(name.data(), O_CLOEXEC);
+                  if ( fd >= 0 ) unlink(name.c_str());
+               }
+               if ( fd < 0 ) {
+                  sp.error = errno;
+                  return false;
+               }
+               sp.segments.push_back({ fd, 0, 0 });
+            }
+
+            SpillSegment & g = sp.segments.back();
+            INDEX n = ( length < sp.segment - g.written ) ? length : sp.segment - g.written;
+
+            for (uint32_t p = 0; p < ds_planes; p++)
+               if ( !transferAll(true, g.fd, const_cast<ITEM*>(src + p * stride), n * sizeof(ITEM),
+               			(size_t(p) * sp.segment + g.written) * sizeof(ITEM)) ) {
+                  sp.error = errno;
+                  return false;
+               }
+
+            g.written += n;
+            sp.spilled.fetch_add(n, std::memory_order_relaxed);
+            src += n;
+            length -= n;
+         }
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Moves as many spilled items as there is room for from the front of the spill
+      queue into the buffer, behind ds_head; the caller holds ds_spill->access, and
+      has renewed ds_tail_seen. A file is closed, and so given back, as soon as it
+      has been read to the end. A failure stops the moving, and is kept in ds_spill
+      for the producer to throw. */
+      void drainSpill()
+      {
+         Spill & sp = *ds_spill;
+         INDEX free = ringFree();
+
+         while ( free && !sp.error && sp.spilled.load(std::memory_order_relaxed) ) {
+            SpillSegment & g = sp.segments.front();
+            INDEX n = ( free < g.written - g.read ) ? free : g.written - g.read;
+            INDEX first = ds_size - (ds_head & ds_mask);
+            if ( first > n ) first = n;
+
+            for (uint32_t p = 0; p < ds_planes; p++) {
+               ITEM * buffer = planeBuffer(p);
+               off_t offset = (size_t(p) * sp.segment + g.read) * sizeof(ITEM);
+
+               if ( !transferAll(false, g.fd, buffer + (ds_head & ds_mask), first * sizeof(ITEM), offset) ||
+                    !transferAll(false, g.fd, buffer, (n - first) * sizeof(ITEM),
+                    				offset + first * sizeof(ITEM)) ) {
+                  sp.error = errno;
+                  return;
+               }
+            }
+
+            g.read += n;
+            ds_head += n;
+            free -= n;
+            sp.spilled.fetch_sub(n, std::memory_order_relaxed);
+
+            if ( g.read == g.written ) {
+               if ( g.written < sp.segment ) g.read = g.written = 0;
+               else {
+                  close(g.fd);
+                  sp.segments.pop_front();
+               }
+            }
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** Lets ds_spill->access go. A reader that has released space meanwhile may
+      have found it taken, and left the spilled items where they were; so if there
+      are such items and space for them, the queue is taken again, unless somebody
+      else has done it already. */
+      void releaseSpill()
+      {
+         for ( ; ; ) {
+            ds_spill->access.release();
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if ( !ds_spill->spilled.load(std::memory_order_relaxed) ||
+                 ds_head_shared.load(std::memory_order_relaxed) - sharedTail() == ds_size ||
+                 !ds_spill->access.try_acquire() ) return;
+
+            ds_tail_seen = fromPoint(ds_tail_shared.load(std::memory_order_acquire), ds_head);
+            drainSpill();
+            publishHead();
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** Ends the writing session after a failure of the spill queue, and throws. */
+      [[noreturn]] void spillError()
+      {
+         int error = ds_spill->error;
+
+         ds_spill->error = 0;
+         ds_writing = false;
+         publishHead();
+         if ( ds_mode == DS_LOCKED ) ds_access.release();
+         releaseSpill();
+         throw DataSourceException(DSEXC_B_SPILL, DSEXC_M_PUT, DSEXC_A_SPILL, strerror(error));
+      }
+
+
+      //**************************************************************************************
+
+      /** Adds "length" items of each plane to the buffer while spilling is enabled:
+      straight into the buffer as far as they fit, if nothing is spilled yet, and the
+      rest to the spill queue, so that the order is kept. */
+      void putSpilled(const ITEM * src, size_t stride, INDEX length)
+      {
+         assert(length <= dataSourceFree());
+
+         INDEX direct = 0;
+         if ( !ds_spill->spilled.load(std::memory_order_relaxed) ) {
+            direct = ringFree();
+            if ( direct > length ) direct = length;
+         }
+
+         INDEX first = ds_size - (ds_head & ds_mask);
+         if ( first > direct ) first = direct;
+
+         for (uint32_t p = 0; p < ds_planes; p++) {
+            ITEM * buffer = planeBuffer(p);
+            memcpy(buffer + (ds_head & ds_mask), src + p * stride, first * sizeof(ITEM));
+            memcpy(buffer, src + p * stride + first, (direct - first) * sizeof(ITEM));
+         }
+         ds_head += direct;
+
+         if ( length > direct && !appendSpill(src + direct, stride, length - direct) ) spillError();
+      }
+
+
+      //**************************************************************************************
+
+      /** Makes the staging area of the spill queue hold at least "length" items of
+      each plane. */
+      void stageSpill(INDEX length)
+      {
+         if ( length <= ds_spill->staged ) return;
+
+         ds_spill->staging.resize(size_t(ds_planes) * length);
+         ds_spill->staged = length;
+      }
+
+
+      //**************************************************************************************
+
+      /** The lower of two release points, either of which may be ds_no_reader. The
+      points are compared by their difference, as they may have wrapped around. */
+      static inline uint64_t lower(uint64_t a, uint64_t b)
+      {
+         if ( a & ds_no_reader ) return b;
+         if ( b & ds_no_reader ) return a;
+
+         return ( pointDistance(b, a) < 0 ) ? a : b;
+      }
+
+
+      //**************************************************************************************
+
+      /** Builds ds_release_tree anew for the registered readers; this takes time
+      proportional to their number, but only when readers are registered or
+      unregistered, or when attachReader() runs out of leaves. The old trees are
+      freed, unless "keep" is set because readers may still be updating them; the
+      release points they record meanwhile are then carried over. */
+      void buildReleaseTree(bool keep = false)
+      {
+         uint32_t leaves = 1;
+         while ( leaves < ds_reader_position.size() ) leaves <<= 1;
+
+         atomic<uint64_t> * tree = new atomic<uint64_t>[2 * leaves];
+         tree[0].store(leaves);
+
+         for (uint32_t n = 0; n < leaves; n++)
+            tree[leaves + n].store(( n < ds_reader_position.size() && !ds_reader_position[n].detached ) ?
+         		pointOf(ds_reader_position[n].released.load()) : ds_no_reader);
+
+         for (uint32_t n = leaves - 1; n > 0; n--)
+            tree[n].store(lower(tree[2 * n].load(), tree[2 * n + 1].load()));
+
+         ds_release_trees.emplace_back(tree);
+         ds_release_tree.store(tree, std::memory_order_seq_cst);
+
+         if ( !keep ) {
+            ds_release_trees.erase(ds_release_trees.begin(), std::prev(ds_release_trees.end()));
+            return;
+         }
+
+         // A reader that has just updated an old tree has already stored its release
+         // point, so it is found here; the points only grow, so storing one again is
+         // harmless.
+         for (uint32_t n = 0; n < ds_reader_position.size(); n++)
+            if ( !ds_reader_position[n].detached )
+               updateRelease(n, pointOf(ds_reader_position[n].released.load()));
+      }
+
+
+      //**************************************************************************************
+
+      /** Records the new release point of reader n and returns the lowest release point
+      of all, in time proportional to the logarithm of the number of readers. In the
+      SPMC mode the readers may do this at the same time: an inner node is only
+      replaced by compare-and-swap, and recomputed whenever another reader has
+      replaced it meanwhile. As long as the release points only grow, a node that
+      stays the same means that so does everything above it. A reader being
+      attached lowers its leaf instead, so it sets "inserted": then every node up to
+      the root is replaced, with its version changed, so that nobody who hasn't
+      seen the new leaf may replace it afterwards. */
+      uint64_t updateRelease(uint32_t n, uint64_t released, bool inserted = false)
+      {
+         atomic<uint64_t> * tree = ds_release_tree.load(std::memory_order_acquire);
+
+         n += tree[0].load(std::memory_order_relaxed);
+         tree[n].store(released, std::memory_order_seq_cst);
+
+         for (n >>= 1; n > 0; n >>= 1) {
+            uint64_t old = tree[n].load(std::memory_order_seq_cst);
+            uint64_t low;
+
+            do {
+               low = lower(tree[2 * n].load(std::memory_order_seq_cst),
+               		   tree[2 * n + 1].load(std::memory_order_seq_cst)) & ds_release_mask;
+               if ( !inserted && low == (old & ds_release_mask) ) break;
+            } while ( !tree[n].compare_exchange_weak(old,
+            			low | ((old + ds_node_version) & ~ds_release_mask),
+            			std::memory_order_seq_cst, std::memory_order_seq_cst) );
+
+            if ( !inserted && low == (old & ds_release_mask) ) break;
+         }
+
+         return tree[1].load(std::memory_order_seq_cst) & ds_release_mask;
+      }
+
+
+      //**************************************************************************************
+
+      /** In the SPMC mode, moves the common tail up to the lowest position that some
+      reader still needs. Any reader may call it, at any time. The root of the tree
+      is read only after the tail, and the tail is replaced only if it hasn't
+      changed in between, epoch included; thus a reader attached meanwhile, which
+      changes the epoch, is never passed by. */
+      void advanceTail()
+      {
+         uint64_t tail = ds_tail_shared.load(std::memory_order_seq_cst);
+
+         for ( ; ; ) {
+            uint64_t lowest = ds_release_tree.load(std::memory_order_seq_cst)[1].load(
+            					std::memory_order_seq_cst) & ds_release_mask;
+
+            if ( (lowest & ds_no_reader) || pointDistance(tail, lowest) <= 0 ) return;
+
+            if ( ds_tail_shared.compare_exchange_weak(tail, (tail & ~ds_point_mask) | lowest,
+            		std::memory_order_seq_cst, std::memory_order_seq_cst) ) {
+               publishedTail(fromPoint(lowest, ds_head_shared.load(std::memory_order_acquire)));
+               return;
+            }
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** In the DS_LOCKED mode, moves the common tail to the lowest release point, as
+      found by updateRelease(). Returns whether it has moved; the caller then calls
+      publishedTail(), after letting the buffer go. */
+      bool settleTail(uint64_t lowest)
+      {
+         lowest &= ds_release_mask;
+         if ( (lowest & ds_no_reader) || lowest == pointOf(ds_tail) ) return false;
+
+         ds_tail = fromPoint(lowest, ds_tail);
+         ds_tail_shared.store(ds_tail, std::memory_order_release);
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Takes a slot for a new reader, reusing the one of a detached reader if there is
+      one, and places the reader at the tail or at the head; see attachReader(). In
+      the DS_LOCKED mode the buffer is held meanwhile, while in the SPMC mode the
+      other readers go on. There, the new reader's leaf lowers the tree, so somebody
+      who has read the root before might still move the tail past the reader; this
+      is prevented by changing the epoch of the tail once the leaf is in, which
+      fails, and is tried again further on, if the tail has moved in the meantime. */
+      uint32_t attachSlot(uint8_t from, uint32_t plane, uint64_t sequence = 0)
+      {
+         assert(plane < ds_planes);
+
+         ds_attach.acquire();
+         if ( ds_mode == DS_LOCKED ) acquireAccess(nullptr);
+
+         if ( ds_mode == DS_SPSC && ds_reader_position.size() > ds_free_slots.size() ) {
+            ds_attach.release();
+	    throw DataSourceException(DSEXC_B_TOO_MANY_READERS,
+	    		DSEXC_M_REGISTER, DSEXC_A_NEW_READER);
+         }
+
+         uint32_t token;
+         try {
+            if ( !ds_free_slots.empty() ) {
+               token = ds_free_slots.back();
+               ds_free_slots.pop_back();
+            } else {
+               token = ds_reader_position.size();
+               ds_slots.acquire();
+               try {
+                  ds_reader_position.emplace_back(token, 0, plane);
+               } catch (...) { ds_slots.release(); throw; }
+               ds_slots.release();
+               ds_reader_position.back().detached = true;
+               if ( token >= ds_release_tree.load()[0].load() ) buildReleaseTree(ds_mode == DS_SPMC);
+            }
+         } catch (exception & e) {
+            if ( ds_mode == DS_LOCKED ) ds_access.release();
+            ds_attach.release();
+            throw DataSourceException(DSEXC_B_PUSH_BACK,
+	    		DSEXC_M_REGISTER, DSEXC_A_DS_CURRENT, e.what());
+         }
+
+         ReaderSlot & r = ds_reader_position[token];
+         r = ReaderSlot(token, 0, plane);
+
+         uint64_t tail = ds_tail_shared.load(std::memory_order_seq_cst);
+         uint64_t lowest;
+         for ( ; ; ) {
+            INDEX head = ds_head_shared.load(std::memory_order_acquire);
+            INDEX start = ( from == DS_FROM_HEAD ) ? head :
+            		 ( ds_mode == DS_LOCKED || ds_mode == DS_SPSC ) ? ds_tail : fromPoint(tail, head);
+
+            if ( from == DS_FROM_SEQUENCE ) {
+               uint64_t first = sequenceOf(start);
+               uint64_t last = ds_head_sequence.load(std::memory_order_acquire);
+               if ( sequence > last ) start = INDEX(last);
+               else if ( sequence > first ) start = INDEX(sequence);
+            }
+
+            r.position = r.head_seen = start;
+            r.released.store(start, std::memory_order_seq_cst);
+#ifdef DATA_SOURCE_STATS
+            r.seen_position.store(start, std::memory_order_relaxed);
+#endif
+            lowest = updateRelease(token, pointOf(start), true);
+
+            if ( ds_mode != DS_SPMC ||
+                 ds_tail_shared.compare_exchange_strong(tail, tail + ds_tail_epoch,
+                 		std::memory_order_seq_cst, std::memory_order_seq_cst) ) break;
+         }
+
+         if ( ds_mode == DS_LOCKED ) {
+            bool moved = settleTail(lowest);
+            INDEX tail = ds_tail;
+            ds_access.release();
+            if ( moved ) publishedTail(tail);
+         }
+
+         ds_attach.release();
+         return token;
+      }
+
+
+      //**************************************************************************************
+
+      /** Frees the slot of reader n for another one, and lets the buffer go of
+      whatever only this reader was holding; see ReaderHandle. */
+      void detachSlot(uint32_t n)
+      {
+         ds_attach.acquire();
+         if ( ds_mode == DS_LOCKED ) acquireAccess(nullptr);
+
+         ReaderSlot & r = ds_reader_position[n];
+         r.detached = true;
+         if ( ds_current == &r ) ds_current = nullptr;
+
+         uint64_t lowest = updateRelease(n, ds_no_reader);
+         ds_free_slots.push_back(n);
+
+         if ( ds_mode == DS_SPMC ) advanceTail();
+
+         if ( ds_mode == DS_LOCKED ) {
+            bool moved = settleTail(lowest);
+            INDEX tail = ds_tail;
+            ds_access.release();
+            if ( moved ) publishedTail(tail);
+         }
+
+         ds_attach.release();
+      }
+
+
+      //**************************************************************************************
+
+      /* The tests of the conditions that coroutines await; see readable() and
+      writable(). */
+
+      static bool readableTest(void * source, void * reader, uint64_t minItems)
+      {
+         DataSource * s = static_cast<DataSource*>(source);
+         ReaderSlot & r = *static_cast<ReaderSlot*>(reader);
+
+         return s->waitReadable(r, INDEX(minItems), std::chrono::nanoseconds(0)) >= minItems ||
+         	s->dataSourceFinished(r);
+      }
+
+      static bool writableTest(void * source, void *, uint64_t minFree)
+      {
+         return static_cast<DataSource*>(source)->waitWritable(INDEX(minFree), std::chrono::nanoseconds(0))
+         								>= minFree;
+      }
+
+      static bool spaceTest(void * source, void *, uint64_t minFree)
+      {
+         return static_cast<DataSource*>(source)->dataSourceSpace() >= minFree;
+      }
+
+
+      //**************************************************************************************
+
+      /* The reader's side of the work, on behalf of the given reader; see the public
+      methods of the same names below. */
+
+      INDEX startDataSource(ReaderSlot & r)
+      {
+         if ( ds_mode == DS_LOCKED ) {
+#ifdef DATA_SOURCE_STATS
+            acquireAccess(&r.wait_ns);
+#else
+            acquireAccess(nullptr);
+#endif
+	 }
+         else if ( ds_resizing != nullptr ) enterSession(r);
+         r.head_seen = ds_head_shared.load(std::memory_order_acquire);
+
+#ifdef DATA_SOURCE_STATS
+         count<uint64_t>(r.read_sessions, 1);
+         if ( ahead(r) == 0 ) count<uint64_t>(r.empty_reads, 1);
+#endif
+         return ahead(r);
+      }
+
+      bool dataSourceFinished(ReaderSlot & r)
+      {
+         if ( !ds_finished.load(std::memory_order_acquire) ) return false;
+
+         return ( r.position == ds_head_shared.load(std::memory_order_relaxed) );
+      }
+
+      INDEX waitReadable(ReaderSlot & r, INDEX minItems, std::chrono::nanoseconds timeout)
+      {
+         assert(minItems <= ds_size);
+
+         INDEX available;
+         auto ready = [&]() {
+            available = ds_head_shared.load(std::memory_order_acquire) - r.position;
+            if ( available >= minItems ) return true;
+            if ( !ds_finished.load(std::memory_order_acquire) ) return false;
+            available = ds_head_shared.load(std::memory_order_acquire) - r.position;
+            return true;
+         };
+
+         if ( ready() || timeout.count() <= 0 ) return available;
+
+         auto deadline = deadlineAfter(timeout);
+
+         ds_readers_waiting.fetch_add(1);
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+
+         // A producer that is waiting for space might have been kept waiting by the
+         // watermark; since this reader won't release anything while it sleeps, let
+         // the producer decide for itself.
+         if ( ds_producer_waiting.load(std::memory_order_relaxed) ) wakeAll(ds_writable_event);
+
+         for ( ; ; ) {
+            uint32_t seen = ds_readable_event.load(std::memory_order_acquire);
+            if ( ready() || !sleepOn(ds_readable_event, seen, deadline) ) break;
+         }
+
+         ds_readers_waiting.fetch_sub(1);
+         return available;
+      }
+
+      DataSourceCondition readable(ReaderSlot & r, INDEX minItems)
+      {
+         assert(minItems <= ds_size);
+
+         return { readableTest, this, &r, minItems, &ds_readable_event, &ds_readers_waiting,
+         					&ds_writable_event, &ds_producer_waiting };
+      }
+
+      ITEM dataItemAt(ReaderSlot & r, Distance n)
+      {
+         ITEM * buffer = planeBuffer(r.plane);
+
+         assert((n >= 0 && n <= (int64_t) ahead(r)) || (n < 0 && -n <= (int64_t) behind(r)));
+
+         return *(buffer + ((r.position + n) & ds_mask));
+      }
+
+      ITEM getData(ReaderSlot & r)
+      {
+         ITEM * buffer = planeBuffer(r.plane);
+
+         assert(ahead(r) > 0);
+
+         ITEM currentItem = *(buffer + (r.position & ds_mask));
+
+         r.position++;
+
+         return currentItem;
+      }
+
+      ITEM takeData(ReaderSlot & r)
+      {
+         ITEM * buffer = planeBuffer(r.plane);
+
+         assert(ahead(r) > 0);
+
+         ITEM currentItem = std::move(*(buffer + (r.position & ds_mask)));
+
+         r.position++;
+
+         return currentItem;
+      }
+
+      void getData(ReaderSlot & r, void * dest, INDEX length)
+      {
+         ITEM * buffer = planeBuffer(r.plane);
+
+         assert(length <= ahead(r));
+
+         if constexpr ( !ds_trivial ) {
+            ITEM * items = static_cast<ITEM*>(dest);
+            for (INDEX k = 0; k < length; k++) items[k] = *(buffer + ((r.position + k) & ds_mask));
+         } else {
+            INDEX continuous = continuousUsed(r);
+            if ( length <= continuous ) {
+               memcpy(dest, buffer + (r.position & ds_mask), length * sizeof(ITEM));
+            } else {
+               INDEX remainder = length - continuous;
+               memcpy(dest, buffer + (r.position & ds_mask), continuous * sizeof(ITEM));
+               memcpy(reinterpret_cast<byte*>(dest) + continuous * sizeof(ITEM),
+	    					buffer, remainder * sizeof(ITEM));
+            }
+         }
+         r.position += length;
+      }
+
+      void takeData(ReaderSlot & r, ITEM * dest, INDEX length)
+      {
+         ITEM * buffer = planeBuffer(r.plane);
+
+         assert(length <= ahead(r));
+
+         if constexpr ( ds_trivial ) getData(r, dest, length);
+         else {
+            for (INDEX k = 0; k < length; k++) dest[k] = std::move(*(buffer + ((r.position + k) & ds_mask)));
+            r.position += length;
+         }
+      }
+
+      void getData(ReaderSlot & r, FILE * dest, INDEX length) requires ds_trivial
+      {
+         ITEM * buffer = planeBuffer(r.plane);
+
+         assert(length <= ahead(r));
+
+         INDEX continuous = continuousUsed(r);
+         if ( length <= continuous ) {
+            uint64_t check = fwrite(buffer + (r.position & ds_mask), sizeof(ITEM), length, dest);
+
+            if ( check != length )
+               throw DataSourceException(DSEXC_B_FWRITE, DSEXC_M_GET, DSEXC_A_COPY_DATA);
+
+         } else {
+            INDEX remainder = length - continuous;
+            uint64_t check = fwrite(buffer + (r.position & ds_mask), sizeof(ITEM), continuous, dest);
+
+            if ( check != continuous )
+               throw DataSourceException(DSEXC_B_FWRITE, DSEXC_M_GET, DSEXC_A_COPY_DATA);
+
+            check = fwrite(buffer, sizeof(ITEM), remainder, dest);
+
+            if ( check != remainder )
+               throw DataSourceException(DSEXC_B_FWRITE, DSEXC_M_GET, DSEXC_A_COPY_DATA);
+
+         }
+         r.position += length;
+      }
+
+      INDEX getData(ReaderSlot & r, int fd, INDEX length, off_t offset) requires ds_trivial
+      {
+         ITEM * buffer = planeBuffer(r.plane);
+
+         assert(length <= ahead(r));
+
+         INDEX continuous = continuousUsed(r);
+         if ( continuous > length ) continuous = length;
+
+         int error;
+         length = transferItems(true, fd, buffer + (r.position & ds_mask), continuous,
+         			buffer, length - continuous, offset, DSEXC_M_GET, error);
+
+         r.position += length;
+         if ( error ) transferFailed(true, DSEXC_M_GET, error);
+         return length;
+      }
+
+      DataSourceSpans<const ITEM> peek(ReaderSlot & r, INDEX length)
+      {
+         ITEM * buffer = planeBuffer(r.plane);
+
+         INDEX available = ahead(r);
+         if ( length > available ) length = available;
+
+         INDEX continuous = continuousUsed(r);
+         const ITEM * start = buffer + (r.position & ds_mask);
+
+         if ( length <= continuous ) return { span<const ITEM>(start, length), span<const ITEM>() };
+
+         return { span<const ITEM>(start, continuous),
+         	  span<const ITEM>(buffer, length - continuous) };
+      }
+
+      void consume(ReaderSlot & r, INDEX length)
+      {
+         assert(length <= ahead(r));
+
+         r.position += length;
+      }
+
+      void dataSourceShift(ReaderSlot & r, Distance amount)
+      {
+         assert((amount >= 0 && amount <= (int64_t) ahead(r)) ||
+	 		(amount < 0 && -amount <= (int64_t) behind(r)));
+
+         r.position += amount;
+      }
+
+      bool seekDataSource(ReaderSlot & r, uint64_t sequence)
+      {
+         INDEX tail = tailFor(r);
+         INDEX index = INDEX(sequence);
+
+         if ( index - tail > r.head_seen - tail || sequenceOf(index) != sequence ) return false;
+
+         r.position = index;
+         return true;
+      }
+
+      void stopDataSource(ReaderSlot & r, INDEX amount)
+      {
+         assert(amount <= behind(r));
+
+#ifdef DATA_SOURCE_STATS
+         count<uint64_t>(r.items_read, r.position - r.seen_position.load(std::memory_order_relaxed));
+         r.seen_position.store(r.position, std::memory_order_relaxed);
+#endif
+
+         if ( ds_mode == DS_SPMC ) {
+            INDEX released = r.released.load(std::memory_order_relaxed) + amount;
+            r.released.store(released, std::memory_order_release);
+            updateRelease(r.token, pointOf(released));
+            advanceTail();
+            if ( ds_resizing != nullptr ) leaveSession(r);
+            return;
+         }
+
+         if ( ds_mode == DS_SPSC ) {
+            ds_tail += amount;
+            ds_tail_shared.store(ds_tail, std::memory_order_release);
+            publishedTail(ds_tail);
+            if ( ds_resizing != nullptr ) leaveSession(r);
+            return;
+         }
+
+         // The tail moves up to the lowest point released by the readers, i.e. only
+         // after all of them have released something.
+         r.released.store(ds_tail + amount, std::memory_order_relaxed);
+         bool released = settleTail(updateRelease(r.token, pointOf(ds_tail + amount)));
+         INDEX tail = ds_tail;
+
+         ds_access.release();
+         if ( released ) publishedTail(tail);
+      }
+
+
+      protected:
+
+
+      //**************************************************************************************
+
+      /** The method called at the beginning of writing in order to prevent
+      collisions. In the SPSC and SPMC modes there is nothing to prevent; the
+      producer only learns how much space the readers have released in the meantime.
+      With spilling enabled, the producer takes the spill queue as well, and first
+      moves into the buffer whatever spilled items fit. */
+      inline void closeDataSource()
+      {
+#ifdef DATA_SOURCE_STATS
+         if ( ds_mode == DS_LOCKED ) acquireAccess(&ds_write_wait_ns);
+#else
+         if ( ds_mode == DS_LOCKED ) acquireAccess(nullptr);
+#endif
+         if ( ds_spill != nullptr ) ds_spill->access.acquire();
+         ds_tail_seen = fromPoint(ds_tail_shared.load(std::memory_order_acquire), ds_head);
+         ds_writing = true;
+         releaseItems(ds_tail_seen);
+
+         if ( ds_spill != nullptr ) {
+            drainSpill();
+            if ( ds_spill->error ) spillError();
+         }
+         if ( ds_resizing != nullptr ) adaptBuffer();
+
+#ifdef DATA_SOURCE_STATS
+         count<uint64_t>(ds_write_sessions, 1);
+         if ( dataSourceFree() == 0 ) count<uint64_t>(ds_write_stalls, 1);
+#endif
+      }
+
+
+      //**************************************************************************************
+
+      /** The total free area of the buffer, in data items; with spilling enabled,
+      together with the room left in the spill queue. */
+      inline INDEX dataSourceFree() { return ringFree() + spillRoom(); };
+
+
+      //**************************************************************************************
+
+      /** Called by the producer outside a writing session in order to wait until the
+      readers have released enough space for "minFree" items, or until the timeout
+      expires. Returns the free space, which is less than "minFree" only after a
+      timeout. The thread sleeps meanwhile; it is woken once the readers have left
+      no more items in the buffer than the low watermark allows, and then checks
+      the free space again. The room in the spill queue counts as free space. */
+      INDEX waitWritable(INDEX minFree, std::chrono::nanoseconds timeout = DS_FOREVER)
+      {
+         assert(minFree <= ds_size);
+         assert(!ds_writing);
+
+         INDEX available;
+         auto ready = [&]() {
+            INDEX tail = sharedTail();
+            available = ds_size - (ds_head_shared.load(std::memory_order_acquire) - tail) + spillRoom();
+            return available >= minFree;
+         };
+
+         if ( ready() || timeout.count() <= 0 ) return available;
+
+         // Rather than wait, a resizable buffer that keeps stalling grows.
+         if ( ds_resizing != nullptr && stalled(std::chrono::steady_clock::now()) && ready() )
+            return available;
+
+         auto deadline = deadlineAfter(timeout);
+
+#ifdef DATA_SOURCE_STATS
+         count<uint64_t>(ds_write_stalls, 1);
+#endif
+         ds_producer_waiting.fetch_add(1);
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+
+         // The readers kept waiting by the high watermark won't get any more now.
+         if ( ds_readers_waiting.load(std::memory_order_relaxed) ) wakeAll(ds_readable_event);
+
+         for ( ; ; ) {
+            uint32_t seen = ds_writable_event.load(std::memory_order_acquire);
+            if ( ready() || !sleepOn(ds_writable_event, seen, deadline) ) break;
+         }
+
+         ds_producer_waiting.fetch_sub(1);
+         return available;
+      }
+
+
+      //**************************************************************************************
+
+      /** What a producer coroutine awaits instead of calling waitWritable(): space
+      for at least "minFree" items. */
+      inline DataSourceCondition writable(INDEX minFree)
+      {
+         assert(minFree <= ds_size);
+
+         return { writableTest, this, nullptr, minFree, &ds_writable_event, &ds_producer_waiting,
+         					&ds_readable_event, &ds_readers_waiting };
+      }
+
+
+      //**************************************************************************************
+
+      /** Add a single data item to the buffer. An item that isn't trivially
+      copyable is moved into it, so that putData(std::move(item)) doesn't copy. */
+      void putData(ITEM item)
+      {
+         assert(ds_planes == 1);
+         assert(dataSourceFree() > 0);
+
+         if constexpr ( !ds_trivial ) std::construct_at(planeBuffer(0) + (ds_head & ds_mask), std::move(item));
+         else if ( ds_spill != nullptr && (ds_spill->spilled.load(std::memory_order_relaxed) || !ringFree()) ) {
+            putSpilled(&item, 0, 1);
+            return;
+         } else *(planeBuffer(0) + (ds_head & ds_mask)) = item;
+      
+         ds_head++;
+      }
+
+
+      //**************************************************************************************
+
+      /** Add a sequence of data items from another buffer to this buffer. */
+      void putData(ITEM * src, INDEX length)
+      {
+         assert(ds_planes == 1);
+         assert(dataSourceFree() >= length);
+
+         if constexpr ( !ds_trivial ) {
+            for (INDEX k = 0; k < length; k++)
+               std::construct_at(planeBuffer(0) + ((ds_head + k) & ds_mask), src[k]);
+
+         } else if ( ds_spill != nullptr ) {
+            putSpilled(src, 0, length);
+            return;
+
+         } else {
+            INDEX continuousAvailable = continuousFree();
+      
+            if ( length <= continuousAvailable ) {
+               memcpy(planeBuffer(0) + (ds_head & ds_mask), src, length * sizeof(ITEM));
+      
+            } else {
+               INDEX remainder = length - continuousAvailable;
+               memcpy(planeBuffer(0) + (ds_head & ds_mask), src, continuousAvailable * sizeof(ITEM));
+               memcpy(planeBuffer(0), src + continuousAvailable, remainder * sizeof(ITEM));
+            }
+         }
+      
+         ds_head += length;
+      }
+
+
+      //**************************************************************************************
+
+      /** Add a sequence of data items from a file to the buffer. Returns the number
+      of items actually read, which is less than "length" at the end of the file or
+      after an error. */
+      INDEX putData(FILE * src, INDEX length) requires ds_trivial
+      {
+         assert(ds_planes == 1);
+         assert(dataSourceFree() >= length);
+
+         if ( ds_spill != nullptr ) {
+            stageSpill(length);
+            length = fread(ds_spill->staging.data(), sizeof(ITEM), length, src);
+            putSpilled(ds_spill->staging.data(), 0, length);
+            return length;
+         }
+      
+         INDEX continuousAvailable = continuousFree();
+      
+         if ( length <= continuousAvailable ) {
+            length = fread(planeBuffer(0) + (ds_head & ds_mask), sizeof(ITEM), length, src);
+      
+         } else {
+            INDEX remainder = length - continuousAvailable;
+            INDEX got = fread(planeBuffer(0) + (ds_head & ds_mask), sizeof(ITEM), continuousAvailable, src);
+
+            length = ( got == continuousAvailable ) ? got + fread(planeBuffer(0), sizeof(ITEM), remainder, src) : got;
+         }
+      
+         ds_head += length;
+         return length;
+      }
+
+
+      //**************************************************************************************
+
+      /** Add a sequence of data items from a file descriptor to the buffer, with a
+      single readv() call covering both parts of the free area (preadv() from the
+      given offset, unless it is negative), without going through stdio. Returns the
+      number of items actually read, which may be less than "length", e.g. at the
+      end of the file, or none at all from a non-blocking descriptor that has
+      nothing; other errors are thrown. So is the end of the file within an item
+      (as EIO), once the whole items before it have been added. */
+      INDEX putData(int fd, INDEX length, off_t offset = -1) requires ds_trivial
+      {
+         assert(ds_planes == 1);
+         assert(dataSourceFree() >= length);
+
+         int error;
+         if ( ds_spill != nullptr ) {
+            stageSpill(length);
+            length = transferItems(false, fd, ds_spill->staging.data(), length, nullptr, 0, offset,
+            						DSEXC_M_PUT, error);
+            putSpilled(ds_spill->staging.data(), 0, length);
+            if ( error ) transferFailed(false, DSEXC_M_PUT, error);
+            return length;
+         }
+
+         INDEX continuousAvailable = continuousFree();
+         if ( continuousAvailable > length ) continuousAvailable = length;
+
+         length = transferItems(false, fd, planeBuffer(0) + (ds_head & ds_mask), continuousAvailable,
+         			planeBuffer(0), length - continuousAvailable, offset, DSEXC_M_PUT, error);
+
+         ds_head += length;
+         if ( error ) transferFailed(false, DSEXC_M_PUT, error);
+         return length;
+      }
+
+
+      //**************************************************************************************
+
+      /** Add a certain number of "zero items" (i.e. fields filled with zeroes,
+      each the size of a data item, or value-initialized items, unless they are
+      trivially copyable) to the buffer; to each of its planes, if there are more. */
+      void putNullData(INDEX length)
+      {
+         assert(dataSourceFree() >= length);
+
+         if constexpr ( ds_trivial ) if ( ds_spill != nullptr ) {
+            stageSpill(length);
+            memset(ds_spill->staging.data(), 0, size_t(ds_planes) * ds_spill->staged * sizeof(ITEM));
+            putSpilled(ds_spill->staging.data(), ds_spill->staged, length);
+            return;
+         }
+      
+         INDEX continuousAvailable = continuousFree();
+      
+         for (uint32_t p = 0; p < ds_planes; p++) {
+            ITEM * buffer = planeBuffer(p);
+      
+            if constexpr ( !ds_trivial ) {
+               for (INDEX k = 0; k < length; k++) std::construct_at(buffer + ((ds_head + k) & ds_mask));
+
+            } else if ( length <= continuousAvailable ) {
+               memset(buffer + (ds_head & ds_mask), 0, length * sizeof(ITEM));
+
+            } else {
+               INDEX remainder = length - continuousAvailable;
+               memset(buffer + (ds_head & ds_mask), 0, continuousAvailable * sizeof(ITEM));
+               memset(buffer, 0, remainder * sizeof(ITEM));
+            }
+         }
+      
+         ds_head += length;
+      }
+
+
+      //**************************************************************************************
+
+      /** Provides the free area of the buffer starting from the "ds_head" marker, so
+      that the producer can fill it directly instead of passing the data through
+      another buffer. The area is "length" items long, or shorter if there is not
+      enough free space. Nothing is added to the buffer until commitWrite(). If
+      there are more planes, each one's area is obtained separately, by passing
+      its number; then a single commitWrite() adds the items to all of them. With
+      spilling enabled, an area that doesn't fit into the buffer (or any area,
+      while items are spilled) is provided by the spill queue, in memory; it has
+      to be of the same length for all the planes then. */
+      DataSourceSpans<ITEM> reserveWrite(INDEX length, uint32_t plane = 0) requires ds_trivial
+      {
+         INDEX free = dataSourceFree();
+         if ( length > free ) length = free;
+
+         if ( ds_spill != nullptr ) {
+            ds_spill->reserved = ds_spill->spilled.load(std::memory_order_relaxed) || length > ringFree();
+
+            if ( ds_spill->reserved ) {
+               stageSpill(length);
+               ds_reserved = length;
+               return { span<ITEM>(ds_spill->staging.data() + size_t(plane) * ds_spill->staged, length),
+               		span<ITEM>() };
+            }
+         }
+
+         INDEX continuousAvailable = continuousFree();
+         ITEM * buffer = planeBuffer(plane);
+         ITEM * start = buffer + (ds_head & ds_mask);
+
+         ds_reserved = length;
+
+         if ( length <= continuousAvailable ) return { span<ITEM>(start, length), span<ITEM>() };
+
+         return { span<ITEM>(start, continuousAvailable),
+         	  span<ITEM>(buffer, length - continuousAvailable) };
+      }
+
+
+      //**************************************************************************************
+
+      /** Adds to the buffer the first "length" items of the area obtained by the
+      preceding reserveWrite(); the rest of the area is left free. */
+      void commitWrite(INDEX length) requires ds_trivial
+      {
+         assert(length <= ds_reserved);
+
+         if ( ds_spill != nullptr && ds_spill->reserved ) {
+            ds_spill->reserved = false;
+            putSpilled(ds_spill->staging.data(), ds_spill->staged, length);
+         }
+         else ds_head += length;
+         ds_reserved = 0;
+      }
+
+
+      //**************************************************************************************
+
+      /** This method should be called when it is known that this object will
+      receive no new data. */
+      inline void setDataSourceFinished()
+      {
+         if ( ds_spill != nullptr && !ds_writing ) ds_spill->access.acquire();
+
+         ds_more = false;
+         if ( ds_writing ) return;
+
+         publishHead();
+         if ( ds_spill != nullptr ) releaseSpill();
+      }
+
+
+      //**************************************************************************************
+
+      /** The method called at the end of writing in order allow reading. */
+      inline void openDataSource()
+      {
+         if ( ds_spill != nullptr ) {
+            ds_tail_seen = fromPoint(ds_tail_shared.load(std::memory_order_acquire), ds_head);
+            drainSpill();
+            if ( ds_spill->error ) spillError();
+         }
+
+         ds_writing = false;
+         publishHead();
+         if ( ds_mode == DS_LOCKED ) ds_access.release();
+         if ( ds_spill != nullptr ) releaseSpill();
+      }
+
+ 
+      public:
+
+
+      //**************************************************************************************
+
+      /** A view of a data source through the eyes of one of its readers. It offers the
+      same reading methods as the data source itself, but they always act on behalf
+      of that reader, so that in the SPMC mode each reader may work in its own thread.
+      A view stays valid until its reader is unregistered or detached. */
+      class Reader
+      {
+         protected:
+
+         DataSource * rd_source;
+
+         ReaderSlot * rd_slot;
+
+         public:
+
+         Reader(DataSource * s, ReaderSlot * r) : rd_source(s), rd_slot(r) { }
+
+         inline INDEX startDataSource() { return rd_source->startDataSource(*rd_slot); }
+
+         inline bool dataSourceFinished() { return rd_source->dataSourceFinished(*rd_slot); }
+
+         inline void pinDataSource() { rd_source->pinDataSource(); }
+
+         inline void unpinDataSource(uint32_t pins = 1) { rd_source->unpinDataSource(pins); }
+
+         inline INDEX waitReadable(INDEX minItems,
+         				std::chrono::nanoseconds timeout = DS_FOREVER)
+         		{ return rd_source->waitReadable(*rd_slot, minItems, timeout); }
+
+         inline DataSourceCondition readable(INDEX minItems)
+         		{ return rd_source->readable(*rd_slot, minItems); }
+
+         inline ITEM dataItemAt(Distance n) { return rd_source->dataItemAt(*rd_slot, n); }
+
+         inline ITEM getData() { return rd_source->getData(*rd_slot); }
+
+         inline ITEM takeData() { return rd_source->takeData(*rd_slot); }
+
+         inline void takeData(ITEM * dest, INDEX length)
+         		{ rd_source->takeData(*rd_slot, dest, length); }
+
+         inline void getData(void * dest, INDEX length)
+         		{ rd_source->getData(*rd_slot, dest, length); }
+
+         inline void getData(void * dest)
+         		{ rd_source->getData(*rd_slot, dest, rd_source->ahead(*rd_slot)); }
+
+         inline void getData(FILE * dest, INDEX length)
+         		{ rd_source->getData(*rd_slot, dest, length); }
+
+         inline void getData(FILE * dest)
+         		{ rd_source->getData(*rd_slot, dest, rd_source->ahead(*rd_slot)); }
+
+         inline INDEX getData(int fd, INDEX length, off_t offset = -1)
+         		{ return rd_source->getData(*rd_slot, fd, length, offset); }
+
+         inline DataSourceSpans<const ITEM> peek(INDEX length)
+         		{ return rd_source->peek(*rd_slot, length); }
+
+         inline DataSourceSpans<const ITEM> peek()
+         		{ return rd_source->peek(*rd_slot, rd_source->ahead(*rd_slot)); }
+
+         inline void consume(INDEX length) { rd_source->consume(*rd_slot, length); }
+
+         inline void dataSourceShift(Distance amount)
+         		{ rd_source->dataSourceShift(*rd_slot, amount); }
+
+         inline uint64_t dataSourceSequence() const { return rd_source->sequenceOf(rd_slot->position); }
+
+         inline bool seekDataSource(uint64_t sequence) { return rd_source->seekDataSource(*rd_slot, sequence); }
+
+         inline void stopDataSource(INDEX amount)
+         		{ rd_source->stopDataSource(*rd_slot, amount); }
+
+         /** The items behind the reader, which stopDataSource() counts from; e.g.
+         to let go of all but the last few it still needs. */
+         inline INDEX dataSourceBehind() { return rd_source->behind(*rd_slot); }
+
+         inline void stopDataSource()
+         		{ rd_source->stopDataSource(*rd_slot,
+				rd_slot->head_seen - rd_source->tailFor(*rd_slot)); }
+      };
+
+
+      //**************************************************************************************
+
+      /** A reader attached by attachReader(): a view that owns its reader, which is
+      detached when the handle is destroyed. Detaching doesn't disturb the other
+      readers, and whatever only this reader was holding is let go at once. */
+      class ReaderHandle : public Reader
+      {
+         public:
+
+         ReaderHandle(DataSource * s, ReaderSlot * r) : Reader(s, r) { }
+
+         ReaderHandle(ReaderHandle && o) noexcept : Reader(o) { o.rd_slot = nullptr; }
+
+         ReaderHandle & operator=(ReaderHandle && o) noexcept
+         {
+            if ( this != &o ) {
+               detach();
+               Reader::operator=(o);
+               o.rd_slot = nullptr;
+            }
+            return *this;
+         }
+
+         ReaderHandle(const ReaderHandle &) = delete;
+
+         ReaderHandle & operator=(const ReaderHandle &) = delete;
+
+         ~ReaderHandle() { detach(); }
+
+         /** The token of the reader, for the methods that take one, e.g. those of
+         DataSourcePipeline. */
+         inline uint32_t token() const { return this->rd_slot->token; }
+
+         /** Detaches the reader before the handle is destroyed; the handle may not be
+         used for reading afterwards. */
+         void detach()
+         {
+            if ( this->rd_slot == nullptr ) return;
+
+            this->rd_source->detachSlot(this->rd_slot->token);
+            this->rd_slot = nullptr;
+         }
+      };
+
+
+      //**************************************************************************************
+
+      /** Called by an aspiring reader before it starts reading from this object.
+      Returns a number which the reader should use in subsequent calls to startDataSource()
+      method. A data source in the SPSC mode accepts only one reader. If the buffer
+      has more planes, the reader chooses the one it will read from. */
+      uint32_t registerDataSource(uint32_t plane = 0)
+      { 
+         assert(plane < ds_planes);
+
+         uint32_t token = ds_reader_position.size();
+
+         if ( ds_mode == DS_SPSC && token > ds_free_slots.size() )
+	    throw DataSourceException(DSEXC_B_TOO_MANY_READERS, 
+	    		DSEXC_M_REGISTER, DSEXC_A_NEW_READER);
+
+         try {
+      
+            ds_reader_position.emplace_back(token, 
+	    			sharedTail(), plane);
+	    buildReleaseTree();
+	    ds_current = &ds_reader_position.back();
+	    					// so that *ds_current is something valid.
+            return token;
+      
+         } catch (exception & e) { 
+            throw DataSourceException(DSEXC_B_PUSH_BACK, 
+	    		DSEXC_M_REGISTER, DSEXC_A_DS_CURRENT, e.what());
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** Attaches a new reader, at any time, even while the others are reading, and
+      provides its handle; the reader is detached when the handle is destroyed. The
+      reader starts either at the tail, with the oldest item still in the buffer, or
+      at the head, with the next item to be written. Unlike registerDataSource(),
+      this may take the slot of a reader detached before, and it takes time
+      proportional to the logarithm of the number of readers, except when the
+      readers outgrow the tree of release points. In the SPMC mode, the readers that
+      read while others are attached must use their views or handles, since a
+      token is looked up in a list that attaching may extend. */
+      inline ReaderHandle attachReader(uint8_t from = DS_FROM_TAIL, uint32_t plane = 0)
+      {
+         uint32_t token = attachSlot(from, plane);
+
+         return ReaderHandle(this, &ds_reader_position[token]);
+      }
+
+
+      //**************************************************************************************
+
+      /** Attaches a new reader like attachReader(), starting from the item of the
+      given sequence number (see dataSourceSequence()), e.g. where a reader that
+      has reconnected stopped before, or where another stream it is aligned with
+      starts. If that item is gone, the reader starts at the tail, and if it
+      hasn't been written yet, at the head; its dataSourceSequence() tells which. */
+      inline ReaderHandle attachReaderAt(uint64_t sequence, uint32_t plane = 0)
+      {
+         uint32_t token = attachSlot(DS_FROM_SEQUENCE, plane, sequence);
+
+         return ReaderHandle(this, &ds_reader_position[token]);
+      }
+
+
+      //**************************************************************************************
+
+      /** Provides the view of this object for the reader with the given token. In the
+      SPMC mode, this is the only way for the readers to read at the same time. */
+      inline Reader reader(uint32_t n)
+      {
+         assert(n < ds_reader_position.size());
+
+         return Reader(this, &ds_reader_position[n]);
+      }
+
+
+      //**************************************************************************************
+
+      /** A reader of this object calls this method in order to be allowed to read
+      from the buffer. The reader passes its token (received upon registration);
+      the method returns the number of data items in the buffer ahead of the
+      "ds_current" marker. */
+      INDEX startDataSource(uint32_t n)
+      {
+         assert(ds_reader_position.size());
+         assert(n <= ds_reader_position.size());
+      
+         // In the locked mode, the "current" reader may only be changed by the
+         // reader that holds the buffer.
+         INDEX items = startDataSource(ds_reader_position[n]);
+         ds_current = &ds_reader_position[n];
+
+         return items;
+      }
+
+
+      //**************************************************************************************
+
+      /** Tells whether there are more data to read from this object. In the SPSC
+      and SPMC modes the answer is "no" only after the reader has taken all that had
+      been published before the producer finished. */
+      inline bool dataSourceFinished()
+      {
+         if ( ds_current == nullptr )
+            return ds_finished.load(std::memory_order_acquire);
+
+         return dataSourceFinished(*ds_current);
+      }
+
+
+      //**************************************************************************************
+
+      /** Called by a reader outside a reading session in order to wait until at
+      least "minItems" items are ready for it, or until the timeout expires. The
+      reader passes its token; the method returns the number of items ready, which
+      is less than "minItems" only after a timeout or when the producer has
+      finished. The thread sleeps meanwhile; it is woken once the buffer holds as
+      many items as the high watermark requires, and then checks again. */
+      inline INDEX waitReadable(uint32_t n, INDEX minItems,
+      				std::chrono::nanoseconds timeout = DS_FOREVER)
+      {
+         assert(n < ds_reader_position.size());
+
+         return waitReadable(ds_reader_position[n], minItems, timeout);
+      }
+
+
+      //**************************************************************************************
+
+      /** What a reader coroutine awaits instead of calling waitReadable(): at least
+      "minItems" items ready for the reader with the given token, or the producer
+      finished. */
+      inline DataSourceCondition readable(uint32_t n, INDEX minItems)
+      {
+         assert(n < ds_reader_position.size());
+
+         return readable(ds_reader_position[n], minItems);
+      }
+ 
+
+      //**************************************************************************************
+
+      /** Provides the data item at the arbitrary position in the buffer, specified
+      by its distance (positive or negative) from the "current" position. */
+      inline ITEM dataItemAt(Distance n) { return dataItemAt(*ds_current, n); }
+
+
+      //**************************************************************************************
+
+      /** Provides the data item at the "current" position and advances the
+      "ds_current" marker by one. */
+      inline ITEM getData() { return getData(*ds_current); }
+
+
+      //**************************************************************************************
+
+      /** Like getData(), but moves the item out of the buffer instead of copying it,
+      e.g. an item that can only be moved, like a std::unique_ptr. What is left in
+      the buffer is the moved-from item, so this is for a reader that no other
+      reader has to share the item with. */
+      inline ITEM takeData() { return takeData(*ds_current); }
+
+
+      //**************************************************************************************
+
+      /** Moves a sequence of items starting from the "current" marker out of the
+      buffer, to the items at "dest"; see takeData(). */
+      inline void takeData(ITEM * dest, INDEX length) { takeData(*ds_current, dest, length); }
+
+
+      //**************************************************************************************
+
+      /** Provides a sequence of data items starting from the "ds_current" marker.
+      It puts the sequence to the memory location "dest", and the number of
+      items is specified by the second argument, "length". The "ds_current" marker
+      is advanced by the number of copied items. */
+      inline void getData(void * dest, INDEX length) { getData(*ds_current, dest, length); }
+
+
+      //**************************************************************************************
 
-   template<typename ITEM> class DataSource 
-   {
+      /** Provides the sequence of all data items in the buffer, starting from the
+      "current" marker.  It puts the sequence to the memory location "dest". The
+      "current" marker is advanced accordingly, so that in the end "ds_current" =
+      "ds_head". */
+      inline void getData(void * dest) { getData(dest, ahead()); }
 
-      #define MAX_SRC_READERS	8
 
-      private:					
- 
-      ITEM * ds_buffer = nullptr;	///< The buffer for storing the data items.
+      //**************************************************************************************
 
-      uint32_t ds_size; 	/**< The size of the data buffer, in items; 
-      					it is always a power of two.*/
+      /** Provides a sequence of data items starting from the "current" marker.
+      It puts the sequence to the file pointed to by "dest", and the number of
+      items is specified by the second argument, "length". The "current" marker
+      is advanced by the number of copied items. */
+      inline void getData(FILE * dest, INDEX length) { getData(*ds_current, dest, length); }
 
-      uint32_t ds_mask; 	/**< The buffer size, in items, minus one; e.g. 
-      			     		the size = %00100000
-			     		the mask = %00011111 */
-                                        
-      uint32_t ds_free; 	/**< The number of free places for data items in the buffer.*/
 
-      uint32_t ds_head = 0; 	/**< The index of the position immediately after the used area.*/
+      //**************************************************************************************
 
-      uint32_t ds_tail = 0; 	/**< The index of the first position in the used area.*/
+      /** Provides the sequence of all data items in the buffer, starting from
+      the "ds_current" marker.  It puts the sequence to the file pointed to by
+      "dest". The "current" marker is advanced accordingly, so that in the end
+      "ds_current" = "ds_head". */
+      inline void getData(FILE * dest) { getData(dest, ahead()); }
 
-      vector<uint32_t> ds_reader_position = { };	
-      				/**< The "current" index for each reader, i.e.  
-				 the index of the item from which it will
-				 continue reading. It is always inside the used area.*/
 
-      vector<uint32_t>::iterator ds_current;	
-      				/**< Points to the "current" index of the current reader. */
+      //**************************************************************************************
 
-      bitset<MAX_SRC_READERS> ds_readers_done;	
-      				/**< The bit map of the readers that have read since 
-				 the last releasing operation. */
+      /** Provides a sequence of data items starting from the "current" marker, written
+      to the file descriptor "fd" with a single writev() call covering both parts of
+      the sequence (pwritev() at the given offset, unless it is negative), without
+      going through stdio. Returns the number of items actually written, which may
+      be less than "length", e.g. when a disk is full, or none at all if a non-
+      blocking descriptor can't take anything; other errors are thrown. The
+      "current" marker is advanced by the number returned. */
+      inline INDEX getData(int fd, INDEX length, off_t offset = -1)
+      			{ return getData(*ds_current, fd, length, offset); }
 
-      bitset<MAX_SRC_READERS> ds_readers_mask; 
-      				///< For easier resetting of ds_readers_done.
 
-      uint32_t ds_release = 0xFFFFFFFF;	
-      				/**< The number of data items that all the readers
-				 have read and won't read any more. */
+      //**************************************************************************************
 
-      bool ds_more = true; 	/**< Whether this object will produce more data, 
-      				 beside what's currently in the buffer. */
+      /** Provides the data items starting from the "current" marker where they lie
+      in the buffer, without copying them: "length" items, or fewer if there are
+      not as many ahead. The "current" marker stays where it is; see consume(). The
+      items remain valid until they are released by stopDataSource(). */
+      inline DataSourceSpans<const ITEM> peek(INDEX length) { return peek(*ds_current, length); }
 
-      binary_semaphore ds_access{1};
 
-#ifdef VERBOSE_DATA_SOURCE
-      string ds_name;	
+      //**************************************************************************************
 
-      char ds_state[512];
-#endif 
+      /** Provides all the data items ahead of the "current" marker, the way peek(length)
+      does; e.g. to run an algorithm over them as a range:
+
+         auto items = peek();
+         auto loud = std::ranges::find_if(items, [](float x) { return x > 0.5f; });
+      */
+      inline DataSourceSpans<const ITEM> peek() { return peek(*ds_current, ahead()); }
 
 
       //**************************************************************************************
 
-      /** The size of the continuous used area starting from the "ds_current" marker,
-      that is, the area terminated either by the "ds_head" marker or by the end of
-      the buffer -- whichever is encountered first. */
-      inline uint32_t continuousUsed()
-      {
-         if ( ds_free == ds_size ) return 0;
-      
-         if ( ds_head > ds_tail ) return ds_head - *ds_current;
-         else return ((*ds_current < ds_tail) ? ds_head - *ds_current : ds_size - *ds_current); 
-      }
+      /** Advances the "current" marker past the given number of items, usually
+      those obtained by peek(). */
+      inline void consume(INDEX length) { consume(*ds_current, length); }
 
 
       //**************************************************************************************
 
-      /** The size of the continuous free area starting from the "ds_head" marker,
-      that is, the area terminated either by the end of the buffer or by the
-      "ds_tail" marker -- whichever is encountered first. */
-      inline uint32_t continuousFree()
-      {
-         if ( ds_free == 0 ) return 0;
-      
-         return (ds_tail <= ds_head) ? ds_size - ds_head : ds_tail - ds_head;
-      }
+      /** Shifts the "current" marker by the specified number of positions;
+      a positive value moves the marker forward, a negative one -- backwards. */
+      inline void dataSourceShift(Distance amount) { dataSourceShift(*ds_current, amount); }
 
 
       //**************************************************************************************
 
-      /** The number of data items in the buffer ahead of the "ds_current" marker. It
-      is supposed to be used by the single reader of this object before it starts
-      reading a fresh amount of data from the buffer. */
-      inline uint32_t ahead()
-      {
-         uint32_t x = (ds_head - *ds_current) & ds_mask;
-      
-         if ( x == 0 ) x = (ds_free == 0 ? ds_size : 0);
-      
-         return x;
-      }
-
-
-      protected:
+      /** The sequence number of the item the current reader will read next. Every
+      item gets the next number when it is written, from 0 on, and keeps it as
+      long as it is in the buffer; the numbers are 64 bits wide, so they never
+      wrap around in practice. */
+      inline uint64_t dataSourceSequence() const { return sequenceOf(ds_current->position); }
 
 
       //**************************************************************************************
 
-      /** The method called at the beginning of writing in order to prevent
-      collisions. */
-      inline void closeDataSource() { ds_access.acquire(); }
+      /** Moves the current reader, during its session, to the item of the given
+      sequence number, either forward, skipping the items in between, or back to
+      an item it hasn't released yet. Returns false, and leaves the reader where it
+      is, if the item isn't within that reach. */
+      inline bool seekDataSource(uint64_t sequence) { return seekDataSource(*ds_current, sequence); }
 
 
       //**************************************************************************************
 
-      /** The total free area of the buffer, in data items. */
-      inline uint32_t dataSourceFree() { return ds_free; };
+      /** A reader of this object calls this method in order to announce that it
+      has finished reading a portion of data from the buffer. The reader passes
+      the number of data items it doesn't need any more, starting from the "ds_tail"
+      marker (in the SPMC mode, from its own tail). */
+      inline void stopDataSource(INDEX amount) { stopDataSource(*ds_current, amount); }
 
 
       //**************************************************************************************
 
-      /** Add a single data item to the buffer. */
-      void putData(ITEM item)
-      {
-         assert(ds_free > 0);
-      
-         *(ds_buffer + ds_head) = item;
-         ds_head = (ds_head + 1) & ds_mask;
-         ds_free--; 
-      }
+      /** A reader of this object calls this method in order to announce that it
+      has finished reading a portion of data from the buffer and that all the
+      remaining data may be discarded. The reader passes its token (received
+      upon registration). */
+      inline void stopDataSource()
+      		{ stopDataSource(ds_current->head_seen - tailFor(*ds_current)); }
 
+      /** Removes the latest n memebers from the list of registered readers.
+      If n = 0, all the readers will be removed. The readers attached by
+      attachReader() are detached by their handles instead. In the DS_LOCKED
+      mode it waits for the buffer, so the caller must not be within a session. */
+      void unregisterDataSource(uint32_t n = 0)
+      { 
+         assert(n <= ds_reader_position.size());
 
-      //**************************************************************************************
+         // In the DS_LOCKED mode the readers are removed, and the tail moved, while
+         // holding the buffer, as by detachSlot(): the producer and the readers left
+         // behind use the release tree within their sessions.
+         bool locked = ( ds_mode == DS_LOCKED );
+         bool moved = false;
+         if ( locked ) {
+            ds_attach.acquire();
+            acquireAccess(nullptr);
+         }
 
-      /** Add a sequence of data items from another buffer to this buffer. */
-      void putData(ITEM * src, uint32_t length)
-      {
-         assert(ds_free >= length);
-      
-         uint32_t continuousAvailable = continuousFree();
-      
-         if ( length <= continuousAvailable ) {
-            memcpy(ds_buffer + ds_head, src, length * sizeof(ITEM));
-            
-            ds_head += length; 
-            if ( ds_head == ds_size ) ds_head = 0; 
-      
-         } else {
-            uint32_t remainder = length - continuousAvailable;
-            memcpy(ds_buffer + ds_head, src, continuousAvailable * sizeof(ITEM));
-            memcpy(ds_buffer, src + continuousAvailable, remainder * sizeof(ITEM));
-            ds_head = remainder; 
+         try {
+            if ( n == 0 ) { 
+	       ds_reader_position.clear(); 
+	       ds_free_slots.clear();
+               ds_current = nullptr;
+	       buildReleaseTree();
+	    } else {
+	       ds_reader_position.erase(
+	          std::next(
+	             ds_reader_position.begin(), 
+		     ds_reader_position.size() - n), 
+	          ds_reader_position.end()
+	       );
+	       std::erase_if(ds_free_slots, [&](uint32_t t) { return t >= ds_reader_position.size(); });
+               ds_current = ds_reader_position.empty() ? nullptr : &ds_reader_position.front();
+	    					// So that *ds_current is something valid.
+	       buildReleaseTree();
+
+	       // The readers left behind may have released more than those removed.
+	       if ( ds_mode == DS_SPMC ) advanceTail();
+	       else if ( locked ) moved = settleTail(ds_release_tree.load()[1].load());
+	    }
+         } catch (...) {
+            if ( locked ) {
+               ds_access.release();
+               ds_attach.release();
+            }
+            throw;
+         }
+
+         if ( locked ) {
+	    INDEX tail = ds_tail;
+	    ds_access.release();
+	    if ( moved ) publishedTail(tail);
+	    ds_attach.release();
          }
-      
-         ds_free -= length; 
       }
 
 
       //**************************************************************************************
 
-      /** Add a sequence of data items from a file to the buffer. */
-      void putData(FILE * src, uint32_t length)
-      {
-         assert(ds_free >= length);
-      
-         uint32_t continuousAvailable = continuousFree();
-      
-         if ( length <= continuousAvailable ) {
-            fread(ds_buffer + ds_head, sizeof(ITEM), length, src);
-            
-            ds_head += length; 
-            if ( ds_head == ds_size ) ds_head = 0; 
-      
-         } else {
-            uint32_t remainder = length - continuousAvailable;
-            fread(ds_buffer + ds_head, sizeof(ITEM), continuousAvailable, src);
-            fread(ds_buffer, sizeof(ITEM), remainder, src);
-            ds_head = remainder; 
-         }
-      
-         ds_free -= length; 
-      }
+      /** The mode the object was constructed with, i.e. DS_LOCKED, DS_SPSC or DS_SPMC. */
+      inline uint8_t dataSourceMode() const { return ds_mode; }
 
 
       //**************************************************************************************
 
-      /** Add a certain number of "zero items" (i.e. fields filled with zeroes,
-      each the size of a data item) to the buffer. */
-      void putNullData(uint32_t length)
-      {
-         assert(ds_free >= length);
-      
-         uint32_t continuousAvailable = continuousFree();
-      
-         if ( length <= continuousAvailable ) {
-            memset(ds_buffer + ds_head, 0, continuousAvailable * sizeof(ITEM));
-            
-            ds_head += length; 
-            if ( ds_head == ds_size ) ds_head = 0; 
-      
-         } else {
-            uint32_t remainder = length - continuousAvailable;
-            memset(ds_buffer + ds_head, 0, continuousAvailable * sizeof(ITEM));
-            memset(ds_buffer, 0, remainder * sizeof(ITEM));
-            ds_head = remainder; 
-         }
-      
-         ds_free -= length; 
-      }
+      /** Whether the buffer is mirrored, i.e. whether every region of it that
+      peek() or reserveWrite() provides is a single span. */
+      inline bool dataSourceMirrored() const { return ds_mirrored; }
 
 
       //**************************************************************************************
 
-      /** This method should be called when it is known that this object will
-      receive no new data. */
-      inline void setDataSourceFinished() { ds_more = false; }
+      /** Whether the buffer is mapped from a file; see the file-backed constructor. */
+      inline bool dataSourceFileBacked() const { return ds_file != nullptr; }
 
 
       //**************************************************************************************
 
-      /** The method called at the end of writing in order allow reading. */
-      inline void openDataSource() { ds_access.release(); }
+      /** Whether the buffer has its own mapping meant for huge pages; see DS_HUGE_PAGES. */
+      inline bool dataSourceHugePages() const { return ds_huge != 0; }
 
- 
-      public:
+
+      //**************************************************************************************
+
+      /** Whether the buffer is locked into the memory; see DS_MLOCKED. */
+      inline bool dataSourceMemoryLocked() const { return ds_memlocked; }
 
 
       //**************************************************************************************
 
-      /** Called by an aspiring reader before it starts reading from this object.
-      Returns a number which the reader should use in subsequent calls to startDataSource()
-      method. */
-      uint32_t registerDataSource()
-      { 
-         uint8_t token = ds_reader_position.size();
+      /** Faults in every page of the buffer, keeping its contents, so that the writing
+      and reading sessions take no page faults later. Pages not touched before get
+      their memory from the NUMA node of the calling thread, so the thread that will
+      use the buffer most may call this before anybody else uses it, instead of the
+      constructor doing so with DS_PREFAULT. */
+      void prefaultDataSource()
+      {
+         size_t bytes = ds_planes * ds_stride * sizeof(ITEM);
 
-         if ( token == MAX_SRC_READERS ) 
-	    throw DataSourceException(DSEXC_B_TOO_MANY_READERS, 
-	    		DSEXC_M_REGISTER, DSEXC_A_NEW_READER);
+#ifdef MADV_POPULATE_WRITE
+         if ( madvise(ds_buffer, bytes, MADV_POPULATE_WRITE) == 0 ) return;
+#endif
+         volatile byte * p = reinterpret_cast<volatile byte*>(ds_buffer);
+         size_t page = sysconf(_SC_PAGESIZE);
 
-         try {
-      
-            ds_reader_position.push_back(0); 	
-	    ds_readers_done.set(token, false);
-	    ds_readers_mask <<= 1;
-	    ds_current = std::prev(ds_reader_position.end()); 
-	    					// so that *ds_current is something valid.
-            return token;
-      
-         } catch (exception & e) { 
-            throw DataSourceException(DSEXC_B_PUSH_BACK, 
-	    		DSEXC_M_REGISTER, DSEXC_A_DS_CURRENT, e.what());
-         }
+         for (size_t k = 0; k < bytes; k += page) p[k] = p[k];
+         p[bytes - 1] = p[bytes - 1];
       }
 
 
       //**************************************************************************************
 
-      /** A reader of this object calls this method in order to be allowed to read
-      from the buffer. The reader passes its token (received upon registration);
-      the method returns the number of data items in the buffer ahead of the
-      "ds_current" marker. */
-      uint32_t startDataSource(uint8_t n)
+      /** Writes the buffer and the indices of a file-backed data source out to the
+      file right away, instead of whenever the kernel sees fit. The process may end
+      at any time without it; this only matters should the whole system go down.
+      Returns false if there is no file, or if writing fails. */
+      bool syncDataSource()
       {
-         assert(ds_reader_position.size());
-         assert(n <= ds_reader_position.size());
-      
-         ds_access.acquire();
-	 ds_readers_done.set(n);
-         ds_current = std::next(ds_reader_position.begin(), n);
-
-         return ahead();
+         return ds_file != nullptr && fdatasync(ds_fd) == 0;
       }
 
 
       //**************************************************************************************
 
-      /** Tells whether there are more data to read from this object. */
-      inline bool dataSourceFinished() { return !ds_more; }
- 
+      /** The size of the buffer, in data items. */
+      inline INDEX dataSourceSize() const { return ds_size; }
+
 
       //**************************************************************************************
 
-      /** Provides the data item at the arbitrary position in the buffer, specified
-      by its distance (positive or negative) from the "current" position. */
-      ITEM dataItemAt(int32_t n)
-      {  
-         assert((n >= 0 && n <= ahead()) || (n < 0 && -n >= ds_size - ds_free - ahead()));
-      
-         return *(ds_buffer + ((*ds_current + n) & ds_mask));
-      }
+      /** The sequence number of the next item to be published, i.e. the number of
+      items published so far; it may be called by anyone at any time. */
+      inline uint64_t dataSourceHeadSequence() const
+      		{ return ds_head_sequence.load(std::memory_order_acquire); }
 
 
       //**************************************************************************************
 
-      /** Provides the data item at the "current" position and advances the
-      "ds_current" marker by one. */
-      ITEM getData()
-      { 
-         assert(ds_free < ds_size); 
-      
-         ITEM currentItem = *(ds_buffer + *ds_current); 
-      
-         *ds_current = (*ds_current + 1) & ds_mask;
-      
-         return currentItem;
-      }
+      /** The sequence number of the oldest item still in the buffer. */
+      inline uint64_t dataSourceTailSequence() const
+      		{ return sequenceOf(sharedTail()); }
 
 
       //**************************************************************************************
 
-      /** Provides a sequence of data items starting from the "ds_current" marker.
-      It puts the sequence to the memory location "dest", and the number of
-      items is specified by the second argument, "length". The "ds_current" marker
-      is advanced by the number of copied items. */
-      void getData(void * dest, uint32_t length)
-      {
-         assert(length <= ds_size - ds_free);
-      
-         uint32_t continuous = continuousUsed();
-         if ( length <= continuous ) {
-            memcpy(dest, ds_buffer + *ds_current, length * sizeof(ITEM));
-            *ds_current += length; 
-            if ( *ds_current == ds_size ) *ds_current = 0;
-         } else {
-            uint32_t remainder = length - continuous;
-            memcpy(dest, ds_buffer + *ds_current, continuous * sizeof(ITEM));
-            memcpy(reinterpret_cast<byte*>(dest) + continuous * sizeof(ITEM), 
-	    					ds_buffer, remainder * sizeof(ITEM));
-            *ds_current = remainder;
-         }
-      }
+      /** The number of planes of the buffer; see DataSourceGroup. */
+      inline uint32_t dataSourcePlanes() const { return ds_planes; }
 
 
       //**************************************************************************************
 
-      /** Provides the sequence of all data items in the buffer, starting from the
-      "current" marker.  It puts the sequence to the memory location "dest". The
-      "current" marker is advanced accordingly, so that in the end "ds_current" =
-      "ds_head". */
-      inline void getData(void * dest) { getData(dest, ahead()); }
+      /** The free space in the buffer, as far as the producer has published it; unlike
+      dataSourceFree(), which the producer uses during its session, it may be called
+      by anyone at any time. The room in the spill queue counts, too. */
+      inline INDEX dataSourceSpace() const
+      {
+         INDEX tail = sharedTail();
+
+         return ds_size - (ds_head_shared.load(std::memory_order_acquire) - tail) + spillRoom();
+      }
 
 
       //**************************************************************************************
 
-      /** Provides a sequence of data items starting from the "current" marker.
-      It puts the sequence to the file pointed to by "dest", and the number of
-      items is specified by the second argument, "length". The "current" marker
-      is advanced by the number of copied items. */
-      void getData(FILE * dest, uint32_t length)
+      /** What a thread other than the producer awaits to see space for at least
+      "minFree" items, as dataSourceSpace() tells it; e.g. DataSourcePipeline, for
+      the nodes writing to the data source. */
+      inline DataSourceCondition spaceCondition(INDEX minFree)
       {
-         assert(length <= ds_size - ds_free);
-      
-         uint32_t continuous = continuousUsed();
-         if ( length <= continuous ) {
-            uint64_t check = fwrite(ds_buffer + *ds_current, sizeof(ITEM), length, dest);
-
-            if ( check != length ) 
-               throw DataSourceException(DSEXC_B_FWRITE, DSEXC_M_GET, DSEXC_A_COPY_DATA);
-
-            *ds_current += length; 
-            if ( *ds_current == ds_size ) *ds_current = 0;
-         } else {
-            uint32_t remainder = length - continuous;
-            uint64_t check = fwrite(ds_buffer + *ds_current, sizeof(ITEM), continuous, dest);
+         assert(minFree <= ds_size);
 
-            if ( check != continuous ) 
-               throw DataSourceException(DSEXC_B_FWRITE, DSEXC_M_GET, DSEXC_A_COPY_DATA);
+         return { spaceTest, this, nullptr, minFree, &ds_writable_event, &ds_producer_waiting,
+         					&ds_readable_event, &ds_readers_waiting };
+      }
 
-            check = fwrite(ds_buffer, sizeof(ITEM), remainder, dest);
 
-            if ( check != remainder ) 
-               throw DataSourceException(DSEXC_B_FWRITE, DSEXC_M_GET, DSEXC_A_COPY_DATA);
+      //**************************************************************************************
 
-            *ds_current = remainder;
-         }
+      /** Sets the fill levels of the buffer at which the sleeping threads are woken:
+      the readers in waitReadable() once the buffer holds at least "high" items, the
+      producer in waitWritable() once it holds no more than "low". By default every
+      item written wakes the readers, and every item released wakes the producer;
+      higher "high" and lower "low" make the threads work in larger batches. */
+      void setDataSourceWatermarks(INDEX high, INDEX low)
+      {
+         ds_high_watermark = ( high == 0 ) ? 1 : ( high > ds_size ) ? ds_size : high;
+         ds_low_watermark = ( low > ds_size ) ? ds_size : low;
       }
 
 
       //**************************************************************************************
 
-      /** Provides the sequence of all data items in the buffer, starting from
-      the "ds_current" marker.  It puts the sequence to the file pointed to by
-      "dest". The "current" marker is advanced accordingly, so that in the end
-      "ds_current" = "ds_head". */
-      inline void getData(FILE * dest) { getData(dest, ahead()); }
+      /** Enables spilling: whatever the producer writes while the buffer is full goes
+      to a queue of temporary files in the given directory instead, each holding up
+      to "segment" items of every plane (by default, as many as the buffer), and is
+      moved into the buffer as the readers release space. The producer is thus held
+      back only once "limit" items wait in the queue. It has to be called before the
+      data source is used, and only once. */
+      void setDataSourceSpill(const string & directory = "/tmp", INDEX limit = DS_SPILL_LIMIT,
+      							INDEX segment = 0) requires ds_trivial
+      {
+         assert(ds_spill == nullptr && ds_resizing == nullptr && !ds_writing);
+
+         ds_spill = std::make_unique<Spill>();
+         ds_spill->directory = directory;
+         ds_spill->limit = limit;
+         ds_spill->segment = ( segment == 0 ) ? ds_size : segment;
+      }
 
 
       //**************************************************************************************
 
-      /** Shifts the "current" marker by the specified number of positions;
-      a positive value moves the marker forward, a negative one -- backwards. */
-      void dataSourceShift(int32_t amount)
-      { 
-         assert((amount >= 0 && amount <= ahead()) || 
-	 		(amount < 0 && -amount >= ds_size - ds_free - ahead()));
-      
-         *ds_current = ((*ds_current + amount) & ds_mask);
+      /** Lets the buffer follow the load: it doubles, up to 2^maxZ items, once the
+      producer has stalled "stalls" times, none of them the "idle" time after the
+      previous one, and halves, down to the size given to the constructor,
+      once it has held no more than a quarter of its size for the "idle" time. The
+      readers keep their places; the memory a smaller buffer no longer needs is
+      given back to the kernel. It has to be called before the data source is used,
+      and only once. In the SPSC and SPMC modes, every reading session has to end
+      with stopDataSource() then. Returns false if the buffer can't be resized:
+      if it is mirrored, file-backed, of a fixed size, or spills. */
+      bool setDataSourceResizing(uint8_t maxZ, uint32_t stalls = DS_GROW_STALLS,
+      					std::chrono::nanoseconds idle = DS_SHRINK_IDLE)
+      {
+         assert(ds_resizing == nullptr && !ds_writing && maxZ < (( sizeof(INDEX) == 4 ) ? 32 : 48));
+
+         if ( Z != 0 || ds_mirrored || ds_fd >= 0 || ds_spill != nullptr ) return false;
+
+         ds_resizing = std::make_unique<Resizing>();
+         ds_resizing->min_size = ds_size;
+         ds_resizing->max_size = ( ds_size > INDEX(1) << maxZ ) ? ds_size : INDEX(1) << maxZ;
+         ds_resizing->stalls = ( stalls == 0 ) ? 1 : stalls;
+         ds_resizing->idle = idle;
+         ds_resizing->busy = std::chrono::steady_clock::now();
+         return true;
       }
 
 
       //**************************************************************************************
 
-      /** A reader of this object calls this method in order to announce that it
-      has finished reading a portion of data from the buffer. The reader passes
-      the number of data items it doesn't need any more, starting from the "ds_tail"
-      marker. */
-      void stopDataSource(uint32_t amount)
-      { 
-         assert(amount <= ((*ds_current == ds_tail && ds_free == 0) ? 
-	 				ds_size : (*ds_current - ds_tail) & ds_mask));
-      
-         if ( amount < ds_release ) ds_release = amount;
-      
-         if ( ds_readers_done.all() ) {
-      
-            assert(ds_release <= ((*ds_current == ds_tail && ds_free == 0) ? 
-	    				ds_size : (*ds_current - ds_tail) & ds_mask));
-            
-            ds_free += ds_release; 
-            
-            if ( ds_free == ds_size ) { 
-               *ds_current = ds_head = ds_tail = 0;
-            } else {
-               ds_tail += ds_release;
-               ds_tail &= ds_mask;
-            }
-            
-            if ( ds_free == ds_size ) 
-	    { 
-	       for (auto p = ds_reader_position.begin(); p < ds_reader_position.end(); p++) 
-	          *p = 0; 
-	    }
-      
-	    ds_readers_done = ds_readers_mask;
-            ds_release = 0xFFFFFFFF;
-      
-         }
+      /** Keeps a buffer that follows the load (see setDataSourceResizing()) where it
+      is, and as large as it is, until unpinDataSource() is called as many times;
+      meanwhile the buffer isn't resized. This is for transfers that go on in the
+      background, on areas of the buffer: e.g. reads into the area of reserveWrite()
+      before commitWrite(), or writes from items not released yet. The producer may
+      pin the buffer at any time; a reader, only within its sessions. */
+      inline void pinDataSource() { ds_pinned.fetch_add(1); }
 
-         ds_access.release();
+      inline void unpinDataSource(uint32_t pins = 1) { ds_pinned.fetch_sub(pins); }
+
+
+      //**************************************************************************************
+
+      /** The number of items of each plane waiting in the spill queue. */
+      inline INDEX dataSourceSpilled() const
+      {
+         return ( ds_spill != nullptr ) ? ds_spill->spilled.load(std::memory_order_relaxed) : 0;
       }
 
 
+#ifdef DATA_SOURCE_STATS
       //**************************************************************************************
 
-      /** A reader of this object calls this method in order to announce that it
-      has finished reading a portion of data from the buffer and that all the
-      remaining data may be discarded. The reader passes its token (received
-      upon registration). */
-      inline void stopDataSource() { stopDataSource(ds_size - ds_free); }
+      /** Collects the counters of this object and of its readers. It may be called
+      by anyone at any time, within a session too, as long as the call doesn't
+      overlap registerDataSource() or unregisterDataSource(); readers may be
+      attached and detached meanwhile. The counters being updated meanwhile may be
+      caught between two sessions. */
+      DataSourceStats dataSourceStats() const
+      {
+         DataSourceStats stats;
+         INDEX head = ds_head_shared.load(std::memory_order_acquire);
 
-      /** Removes the latest n memebers from the list of registered readers.
-      If n = 0, all the readers will be removed. */
-      void unregisterDataSource(uint8_t n = 0)
-      { 
-         assert(n <= ds_reader_position.size());
+         stats.items_written = ds_items_written.load(std::memory_order_relaxed);
+         stats.bytes_written = stats.items_written * sizeof(ITEM) * ds_planes;
+         stats.write_sessions = ds_write_sessions.load(std::memory_order_relaxed);
+         stats.write_stalls = ds_write_stalls.load(std::memory_order_relaxed);
+         stats.high_water = ds_high_water.load(std::memory_order_relaxed);
+         stats.access_wait_ns = ds_write_wait_ns.load(std::memory_order_relaxed);
 
-         if ( n == 0 ) { 
-	    ds_reader_position.clear(); 
-            ds_current = ds_reader_position.end();
-	    ds_readers_mask.set();
-	    ds_readers_done.set(); 
-	 } else {
-	    ds_reader_position.erase(
-	       std::next(
-	          ds_reader_position.begin(), 
-		  ds_reader_position.size() - n), 
-	       ds_reader_position.end()
-	    );
-            ds_current = ds_reader_position.begin(); // So that *ds_current is something valid.
-	    ds_readers_mask = (ds_readers_mask >> n) | ds_readers_mask;
-	    ds_readers_done = ds_readers_mask;
-	 }
-         
+         ds_slots.acquire();
+         try {
+            for (auto & r : ds_reader_position) {
+               stats.items_read += r.items_read.load(std::memory_order_relaxed);
+               stats.read_sessions += r.read_sessions.load(std::memory_order_relaxed);
+               stats.empty_reads += r.empty_reads.load(std::memory_order_relaxed);
+               stats.access_wait_ns += r.wait_ns.load(std::memory_order_relaxed);
+               stats.reader_lag.push_back(r.detached ? 0 :
+               			head - r.seen_position.load(std::memory_order_relaxed));
+            }
+         } catch (...) { ds_slots.release(); throw; }
+         ds_slots.release();
+         stats.bytes_read = stats.items_read * sizeof(ITEM);
+
+         return stats;
       }
+#endif
 
 
 #ifdef VERBOSE_DATA_SOURCE
@@ -495,13 +3257,16 @@ using std::exception;
 
       const char * dataSourceState() 
       { 
-         ds_current < ds_reader_position.end() ? 
-            sprintf(ds_state, "SRC %s: tail = %d; current = %d; "
-	                      "head = %d; ahead = %d; free = %d", 
-                   ds_name.data(), ds_tail, *ds_current, ds_head, ahead(), ds_free) :
-            sprintf(ds_state, "SRC %s: tail = %d; current = ??; "
-	                      "head = %d; ahead = ??; free = %d", 
-                   ds_name.data(), ds_tail, ds_head, ds_free);
+         uint64_t tail = sharedTail();
+
+         ds_current != nullptr ?
+            sprintf(ds_state, "SRC %s: tail = %" PRIu64 "; current = %" PRIu64 "; "
+	                      "head = %" PRIu64 "; ahead = %" PRIu64 "; free = %" PRIu64, 
+                   ds_name.data(), tail & ds_mask, uint64_t(ds_current->position & ds_mask),
+		   uint64_t(ds_head & ds_mask), uint64_t(ahead()), uint64_t(dataSourceFree())) :
+            sprintf(ds_state, "SRC %s: tail = %" PRIu64 "; current = ??; "
+	                      "head = %" PRIu64 "; ahead = ??; free = %" PRIu64, 
+                   ds_name.data(), tail & ds_mask, uint64_t(ds_head & ds_mask), uint64_t(dataSourceFree()));
 
          return ds_state; 
       }
@@ -511,49 +3276,100 @@ using std::exception;
       //**************************************************************************************
 
       /** The default constructor. The value passed is the binary logarithm of
-      the buffer size, i.e. the buffer will be of size 2^z. */
-      DataSource(uint8_t z = 16)
+      the buffer size, i.e. the buffer will be of size 2^z. The mode is one of
+      DS_LOCKED, DS_SPSC and DS_SPMC, optionally combined with DS_MIRRORED and with
+      the options for the memory, DS_HUGE_PAGES, DS_PREFAULT and DS_MLOCKED. The
+      number of planes is normally left at one; see DataSourceGroup. */
+      DataSource(uint8_t z = 16, uint8_t mode = DS_LOCKED, uint32_t planes = 1) requires ( Z == 0 )
+      : ds_planes(planes), ds_mode(mode & DS_MODE_MASK), ds_memory(mode & DS_MEMORY_MASK)
       { 
-         ds_size = 1 << z;
-         ds_buffer = reinterpret_cast<ITEM*>(malloc(ds_size * sizeof(ITEM)));
-         if ( ds_buffer == nullptr ) 
+         setSize(INDEX(1) << z);
+         if ( !allocateBuffer(mode & DS_MIRRORED) ) 
             throw DataSourceException(DSEXC_B_MALLOC, DSEXC_M_CONSTR, DSEXC_A_ALLOCATE); 
-         ds_free = ds_size;
-         ds_mask = ds_size - 1;
-	 ds_current = ds_reader_position.end();
-	 ds_readers_done.set();
-	 ds_readers_mask.set();
+	 buildReleaseTree();
+	 ds_low_watermark = ds_size;
+      }
+ 
+
+      //**************************************************************************************
+
+      /** The constructor of a data source of a fixed size, DataSource<ITEM, Z>: its
+      buffer of 2^Z items is a part of the object, so nothing is allocated for it,
+      and the size and the mask are constants to the compiler. The mode is one of
+      DS_LOCKED, DS_SPSC and DS_SPMC; the options don't apply. */
+      explicit DataSource(uint8_t mode = DS_LOCKED) requires ( Z != 0 )
+      : ds_mode(mode & DS_MODE_MASK)
+      {
+         allocateBuffer(false);
+	 buildReleaseTree();
+	 ds_low_watermark = ds_size;
+      }
+ 
+
+      //**************************************************************************************
+
+      /** The file-backed constructor: the buffer is mapped from the given file instead
+      of being allocated, so that the kernel can page it out, and its contents outlive
+      the process. A new file is made for a buffer of 2^z items. A file made earlier
+      for the same type of items and number of planes is opened again as it is, z
+      being ignored, together with the head and the tail last published; readers
+      registered afterwards start from the oldest item that wasn't released. The
+      file stays locked, so that no other data source can open it meanwhile. */
+      DataSource(const string & path, uint8_t z = 16, uint8_t mode = DS_LOCKED, uint32_t planes = 1)
+      requires ( Z == 0 )
+      : ds_planes(planes), ds_mode(mode & DS_MODE_MASK), ds_memory(mode & DS_MEMORY_MASK)
+      {
+         static_assert(std::is_trivially_copyable_v<ITEM>, "The items are stored in a file as they are.");
+
+         setSize(INDEX(1) << z);
+         openFile(path.c_str(), mode & DS_MIRRORED);
+	 buildReleaseTree();
+	 ds_low_watermark = ds_size;
       }
  
 
       //**************************************************************************************
 
-      /** The copy constructor. */
-      DataSource(const DataSource & oSrc) : ds_access(1)
+      /** The copy constructor. The copy of a file-backed data source has its buffer
+      in memory; the copy of one that spills doesn't, and gets none of the items
+      spilled. Items that aren't trivially copyable are copied one by one, and
+      only those the buffer is holding. */
+      DataSource(const DataSource & oSrc) requires std::copy_constructible<ITEM> : ds_access(1)
       { 
          // Make a copy of the other source's buffer.
-         ds_size = oSrc.ds_size; 	
-         ds_mask = oSrc.ds_mask; 		
-         ds_buffer = reinterpret_cast<ITEM*>(malloc(ds_size * sizeof(ITEM)));
-         if ( ds_buffer == nullptr ) 
+         setSize(oSrc.ds_size);
+         ds_planes = oSrc.ds_planes;
+         ds_mode = oSrc.ds_mode;
+         ds_memory = oSrc.ds_memory;
+         if ( !allocateBuffer(oSrc.ds_mirrored) ) 
             throw DataSourceException(DSEXC_B_MALLOC, DSEXC_M_CONSTR_COPY, DSEXC_A_ALLOCATE);
          if ( oSrc.ds_buffer != nullptr ) {
-            memcpy(ds_buffer, oSrc.ds_buffer, ds_size * sizeof(ITEM));
+            for (uint32_t p = 0; p < ds_planes; p++) {
+               const ITEM * from = oSrc.ds_buffer + p * oSrc.ds_stride;
+               if constexpr ( ds_trivial ) memcpy(planeBuffer(p), from, ds_size * sizeof(ITEM));
+               else for (INDEX i = oSrc.ds_destroyed; i != oSrc.ds_head; i++)
+                  std::construct_at(planeBuffer(p) + (i & ds_mask), from[i & ds_mask]);
+            }
 	 }
-         ds_free = oSrc.ds_free; 
+         ds_destroyed = oSrc.ds_destroyed;
       
          // Replicate the other source's state.
          ds_head = oSrc.ds_head; 		
          ds_tail = oSrc.ds_tail; 		
-         uint8_t d = std::distance<vector<uint32_t>::const_iterator>
-	 				(oSrc.ds_reader_position.begin(), oSrc.ds_current);
+         ds_tail_seen = oSrc.ds_tail_seen;
+         ds_head_shared.store(oSrc.ds_head_shared.load());
+         ds_head_sequence.store(oSrc.ds_head_sequence.load());
+         ds_tail_shared.store(oSrc.ds_tail_shared.load());
+         ds_finished.store(oSrc.ds_finished.load());
          ds_reader_position = oSrc.ds_reader_position; 	
-         ds_current = std::next(ds_reader_position.begin(), d); 
+         ds_free_slots = oSrc.ds_free_slots;
+         ds_current = ( oSrc.ds_current == nullptr ) ? nullptr :
+         			&ds_reader_position[oSrc.ds_current->token];
 
-         ds_readers_done = oSrc.ds_readers_done;           
-         ds_readers_mask = oSrc.ds_readers_mask;           
-         ds_release = oSrc.ds_release;	
+         buildReleaseTree();
          ds_more = oSrc.ds_more; 		
+         ds_high_watermark = oSrc.ds_high_watermark;
+         ds_low_watermark = oSrc.ds_low_watermark;
 
 #ifdef VERBOSE_DATA_SOURCE
          ds_name = oSrc.ds_name;	
@@ -565,24 +3381,49 @@ using std::exception;
 
       /** The move constructor. */
       DataSource(DataSource && oSrc) noexcept 
-      : ds_access(1), ds_reader_position(move(oSrc.ds_reader_position))
+      : ds_access(1), ds_reader_position(move(oSrc.ds_reader_position)),
+        ds_free_slots(move(oSrc.ds_free_slots))
       { 
-         // Take the other source's buffer.
+         // Take the other source's buffer, or a copy of the one inside it.
          ds_buffer = oSrc.ds_buffer;
          oSrc.ds_buffer = nullptr;
-         ds_size = oSrc.ds_size; 	
-         ds_mask = oSrc.ds_mask; 		
+         if constexpr ( Z != 0 ) {
+            if constexpr ( ds_trivial ) memcpy(this->ds_inline, oSrc.ds_inline, sizeof(this->ds_inline));
+            else moveItems(oSrc.planeBuffer(0), ds_mask, planeBuffer(0), ds_mask,
+            						oSrc.ds_destroyed, oSrc.ds_head);
+            ds_buffer = planeBuffer(0);
+         }
+         ds_file = oSrc.ds_file;
+         oSrc.ds_file = nullptr;
+         ds_fd = oSrc.ds_fd;
+         oSrc.ds_fd = -1;
+         ds_spill = move(oSrc.ds_spill);
+         ds_resizing = move(oSrc.ds_resizing);
+         setSize(oSrc.ds_size);
+         ds_mode = oSrc.ds_mode;
+         ds_mirrored = oSrc.ds_mirrored;
+         ds_memory = oSrc.ds_memory;
+         ds_huge = oSrc.ds_huge;
+         ds_memlocked = oSrc.ds_memlocked;
+         ds_planes = oSrc.ds_planes;
+         ds_stride = oSrc.ds_stride;
       
          // Replicate the other source's state.
-         ds_free = oSrc.ds_free; 
          ds_head = oSrc.ds_head; 		
          ds_tail = oSrc.ds_tail; 		
+         ds_tail_seen = oSrc.ds_tail_seen;
+         ds_destroyed = oSrc.ds_destroyed;
+         ds_head_shared.store(oSrc.ds_head_shared.load());
+         ds_head_sequence.store(oSrc.ds_head_sequence.load());
+         ds_tail_shared.store(oSrc.ds_tail_shared.load());
+         ds_finished.store(oSrc.ds_finished.load());
          ds_current = oSrc.ds_current; 
+         oSrc.ds_current = nullptr;
 
-         ds_readers_done = oSrc.ds_readers_done;           
-         ds_readers_mask = oSrc.ds_readers_mask;           
-         ds_release = oSrc.ds_release;	
+         buildReleaseTree();
          ds_more = oSrc.ds_more; 		
+         ds_high_watermark = oSrc.ds_high_watermark;
+         ds_low_watermark = oSrc.ds_low_watermark;
 
 #ifdef VERBOSE_DATA_SOURCE
          ds_name = move(oSrc.ds_name);	
@@ -595,23 +3436,49 @@ using std::exception;
       /** The assignment constructor. */
       DataSource & operator=(DataSource && oSrc) 
       { 
-         // Take the other source's buffer.
+         // Take the other source's buffer, or a copy of the one inside it.
+         releaseBuffer();
          ds_buffer = oSrc.ds_buffer;
          oSrc.ds_buffer = nullptr;
-         ds_size = oSrc.ds_size; 	
-         ds_mask = oSrc.ds_mask; 		
+         if constexpr ( Z != 0 ) {
+            if constexpr ( ds_trivial ) memcpy(this->ds_inline, oSrc.ds_inline, sizeof(this->ds_inline));
+            else moveItems(oSrc.planeBuffer(0), ds_mask, planeBuffer(0), ds_mask,
+            						oSrc.ds_destroyed, oSrc.ds_head);
+            ds_buffer = planeBuffer(0);
+         }
+         ds_file = oSrc.ds_file;
+         oSrc.ds_file = nullptr;
+         ds_fd = oSrc.ds_fd;
+         oSrc.ds_fd = -1;
+         ds_spill = move(oSrc.ds_spill);
+         ds_resizing = move(oSrc.ds_resizing);
+         setSize(oSrc.ds_size);
+         ds_mode = oSrc.ds_mode;
+         ds_mirrored = oSrc.ds_mirrored;
+         ds_memory = oSrc.ds_memory;
+         ds_huge = oSrc.ds_huge;
+         ds_memlocked = oSrc.ds_memlocked;
+         ds_planes = oSrc.ds_planes;
+         ds_stride = oSrc.ds_stride;
       
          // Replicate the other source's state.
-         ds_free = oSrc.ds_free; 
          ds_head = oSrc.ds_head; 		
          ds_tail = oSrc.ds_tail; 		
+         ds_tail_seen = oSrc.ds_tail_seen;
+         ds_destroyed = oSrc.ds_destroyed;
+         ds_head_shared.store(oSrc.ds_head_shared.load());
+         ds_head_sequence.store(oSrc.ds_head_sequence.load());
+         ds_tail_shared.store(oSrc.ds_tail_shared.load());
+         ds_finished.store(oSrc.ds_finished.load());
          ds_current = oSrc.ds_current; 
+         oSrc.ds_current = nullptr;
          ds_reader_position = move(oSrc.ds_reader_position); 	
+         ds_free_slots = move(oSrc.ds_free_slots);
 
-         ds_readers_done = oSrc.ds_readers_done;           
-         ds_readers_mask = oSrc.ds_readers_mask;           
-         ds_release = oSrc.ds_release;	
+         buildReleaseTree();
          ds_more = oSrc.ds_more; 		
+         ds_high_watermark = oSrc.ds_high_watermark;
+         ds_low_watermark = oSrc.ds_low_watermark;
 
 #ifdef VERBOSE_DATA_SOURCE
          ds_name = move(oSrc.ds_name);	
@@ -625,10 +3492,10 @@ using std::exception;
       /** The default destructor. */
       virtual ~DataSource()
       { 
-         free(ds_buffer); 
+         releaseBuffer(); 
       }
 
    };
 
 
-
+#endif
@@ -0,0 +1,112 @@
+#ifndef DATA_SOURCE_CONVERTER_HPP
+#define DATA_SOURCE_CONVERTER_HPP
+
+#include <DataSource.hpp>
+#include <DataSourceKernels.hpp>
+
+
+
+   /* A stage that reads samples of type A from a data source and produces them, as
+   samples of type B, in a data source of its own; e.g. int16_t or 24-bit PCM for
+   readers that want float. The samples go straight from the buffer of the one to
+   the buffer of the other through convertSamples() (see DataSourceKernels.hpp), a
+   piece at a time between the places where either buffer wraps around, so no
+   other buffer is needed in between. The stage finishes once the data source it
+   reads from has finished and everything has been converted. */
+   template<typename A, typename B> class DataSourceConverter : public DataSource<B>
+   {
+
+      private:
+
+      typename DataSource<A>::Reader dsc_reader;
+
+      DataSourceConversion dsc_conversion;
+
+      uint64_t dsc_converted = 0;	///< The samples converted so far.
+
+      bool dsc_done = false;
+
+
+      public:
+
+
+      //**************************************************************************************
+
+      /** Converts what the reader of the given token reads, into a buffer of 2^z
+      samples in the given mode. */
+      DataSourceConverter(DataSource<A> & source, uint32_t token, uint8_t z, uint8_t mode = DS_LOCKED,
+      			const DataSourceConversion & conversion = DataSourceConversion())
+      : DataSource<B>(z, mode), dsc_reader(source.reader(token)), dsc_conversion(conversion)
+      { }
+
+
+      //**************************************************************************************
+
+      /** Does one round of the work: converts as many samples as there are to read
+      and there is space for. If there was nothing to do, and unless "wait" is
+      false, it then waits for samples or for space. Returns false once it has
+      converted everything. */
+      bool step(bool wait = true)
+      {
+         if ( dsc_done ) return false;
+
+         uint32_t available = dsc_reader.startDataSource();
+
+         this->closeDataSource();
+         DataSourceSpans<B> area = this->reserveWrite(available);
+         DataSourceSpans<const A> items = dsc_reader.peek(area.size());
+
+         // The two regions may wrap around at different places.
+         uint32_t length = items.size();
+         for (uint32_t done = 0; done < length; ) {
+            span<const A> from = ( done < items.first.size() ) ? items.first.subspan(done) :
+            					items.second.subspan(done - items.first.size());
+            span<B> to = ( done < area.first.size() ) ? area.first.subspan(done) :
+            					area.second.subspan(done - area.first.size());
+            uint32_t n = std::min(from.size(), to.size());
+
+            convertSamples(from.data(), to.data(), n, dsc_conversion);
+            done += n;
+         }
+
+         dsc_reader.consume(length);
+         dsc_reader.stopDataSource(dsc_reader.dataSourceBehind());
+         this->commitWrite(length);
+         dsc_converted += length;
+
+         dsc_done = dsc_reader.dataSourceFinished();
+         if ( dsc_done ) this->setDataSourceFinished();
+         this->openDataSource();
+
+         if ( dsc_done ) return false;
+
+         if ( wait && length == 0 ) {
+            if ( available == 0 ) dsc_reader.waitReadable(1);
+            else this->waitWritable(1);
+         }
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Converts everything, as the samples come and the readers make space. */
+      void run() { while ( step() ) { } }
+
+
+      //**************************************************************************************
+
+      /** How the samples are converted; it may be changed between the steps, e.g. to
+      change the gain. */
+      inline DataSourceConversion & dataSourceConversion() { return dsc_conversion; }
+
+
+      //**************************************************************************************
+
+      /** The number of samples converted so far. */
+      inline uint64_t converted() const { return dsc_converted; }
+
+   };
+
+
+#endif
@@ -7,16 +7,32 @@ char DataSourceException::dse_string[DS_EXC_STRINGS][DS_EXC_STR_SIZE] =
    "LibC++ error (vector<uint4>::push_back)", 
    "LibC error (fwrite)",                     
    "LibC error (malloc)",                     
+   "LibC error (open, flock, ftruncate or mmap)",
+   "The file holds no matching data source",
+   "LibC error (spill file)",
+   "LibC error (readv or writev)",
+   "LibC error (io_uring, preadv or pwritev)",
+   "No coroutine can go on or awaits a data source",
 
    "DataSource::registerDataSource", 
    "DataSource::get",                
    "DataSource::DataSource",         
    "DataSource::DataSource (copy)",
+   "DataSource::DataSource (file)",
+   "DataSource::putData",
+   "DataSourceAio::complete",
+   "DataSourceFileSink::step",
+   "DataSourceFileSource::step",
+   "DataSourceLoop::run",
 
    "add a new reader",
    "create ds_current index for a sound source",
    "copy the data to the file block",
-   "allocate space for the circular buffer"
+   "allocate space for the circular buffer",
+   "map the circular buffer from a file",
+   "move the items to or from the spill queue",
+   "copy the data from a file descriptor",
+   "wait for the conditions of the coroutines"
 };
 
 thread_local char * DataSourceException::dse_brief;
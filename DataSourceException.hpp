@@ -7,16 +7,32 @@
       DSEXC_B_PUSH_BACK,
       DSEXC_B_FWRITE,
       DSEXC_B_MALLOC,
+      DSEXC_B_FILE,
+      DSEXC_B_FILE_FORMAT,
+      DSEXC_B_SPILL,
+      DSEXC_B_FD,
+      DSEXC_B_AIO,
+      DSEXC_B_STALLED,
 
       DSEXC_M_REGISTER,  
       DSEXC_M_GET,       
       DSEXC_M_CONSTR,    
       DSEXC_M_CONSTR_COPY,
+      DSEXC_M_CONSTR_FILE,
+      DSEXC_M_PUT,
+      DSEXC_M_AIO,
+      DSEXC_M_FILE_SINK,
+      DSEXC_M_FILE_SOURCE,
+      DSEXC_M_LOOP,
 
       DSEXC_A_NEW_READER,
       DSEXC_A_DS_CURRENT,
       DSEXC_A_COPY_DATA,
-      DSEXC_A_ALLOCATE
+      DSEXC_A_ALLOCATE,
+      DSEXC_A_MAP_FILE,
+      DSEXC_A_SPILL,
+      DSEXC_A_READ_DATA,
+      DSEXC_A_AWAIT
    };
 
 
@@ -27,7 +43,7 @@
    
 #define ORIG_MSG_SIZE 1024
 #define DS_EXC_STR_SIZE  64
-#define DS_EXC_STRINGS   12
+#define DS_EXC_STRINGS   28
 
       private:
 
@@ -0,0 +1,77 @@
+#ifndef DATA_SOURCE_GROUP_HPP
+#define DATA_SOURCE_GROUP_HPP
+
+#include <DataSource.hpp>
+#include <DataSourceKernels.hpp>
+
+
+
+   /* A data source whose buffer consists of several planes, e.g. one for each
+   channel of a sound. All the planes always hold the same number of items, so they
+   share a single set of indices, a single access control and a single list of
+   readers: one writing session fills all of them, and the cost of a session doesn't
+   depend on the number of planes. Each reader reads the plane it has chosen upon
+   registration. */
+
+   template<typename ITEM> class DataSourceGroup : public DataSource<ITEM>
+   {
+
+      private:
+
+      vector<ITEM*> dsg_first;	///< The first spans of the planes' areas, for putFrames().
+
+      vector<ITEM*> dsg_second;	///< The second spans of the planes' areas, for putFrames().
+
+
+      protected:
+
+
+      //**************************************************************************************
+
+      /** Add a sequence of interleaved frames, each consisting of one item for every
+      plane, from another buffer to this buffer. */
+      void putFrames(const ITEM * src, uint32_t frames)
+      {
+         uint32_t planes = this->dataSourcePlanes();
+
+         assert(frames <= this->dataSourceFree());
+
+         uint32_t beforeWrap = 0;
+         for (uint32_t p = 0; p < planes; p++) {
+            DataSourceSpans<ITEM> area = this->reserveWrite(frames, p);
+            dsg_first[p] = area.first.data();
+            dsg_second[p] = area.second.data();
+            beforeWrap = area.first.size();
+         }
+
+         deinterleave(src, dsg_first.data(), beforeWrap, planes);
+         if ( frames > beforeWrap )
+            deinterleave(src + beforeWrap * planes, dsg_second.data(), frames - beforeWrap, planes);
+
+         this->commitWrite(frames);
+      }
+
+
+      public:
+
+
+      //**************************************************************************************
+
+      /** The constructor. The buffer will have the given number of planes, each of
+      size 2^z; the mode is the same as with DataSource. */
+      DataSourceGroup(uint8_t z, uint32_t planes, uint8_t mode = DS_LOCKED)
+      : DataSource<ITEM>(z, mode, planes), dsg_first(planes), dsg_second(planes)
+      { }
+
+
+      //**************************************************************************************
+
+      /** The file-backed constructor; see the one of DataSource. */
+      DataSourceGroup(const string & path, uint8_t z, uint32_t planes, uint8_t mode = DS_LOCKED)
+      : DataSource<ITEM>(path, z, mode, planes), dsg_first(planes), dsg_second(planes)
+      { }
+
+   };
+
+
+#endif
@@ -0,0 +1,720 @@
+#ifndef DATA_SOURCE_IO_HPP
+#define DATA_SOURCE_IO_HPP
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <DataSource.hpp>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define DS_IO_URING
+#endif
+
+#define DS_DIRECT_ALIGN	4096	// The alignment O_DIRECT is given: of the memory, the length and the offset.
+
+
+
+   /* Reads and writes files in the background, so that the thread that asks for it
+   can go on meanwhile. It uses an io_uring instance of its own, set up with the
+   raw system calls; where io_uring isn't available (e.g. forbidden by a seccomp
+   filter), a few threads doing preadv() and pwritev() take its place. The memory
+   of a request, and the request itself, must stay where they are until complete()
+   reports it done. Only one thread may use an object. */
+   class DataSourceAio
+   {
+
+      public:
+
+      struct Request
+      {
+         bool writing;
+
+         int fd;
+
+         iovec io;		///< The memory to read into or to write from.
+
+         off_t offset;		///< The position in the file.
+
+         ssize_t result;	///< The bytes moved, or minus errno, once done.
+
+         bool done;
+      };
+
+      /* A request of the stages below, together with the items it moves. */
+      struct Transfer
+      {
+         Request request;
+
+         uint32_t items;
+
+         off_t start;		///< Where it starts in the file.
+
+         inline size_t moved() const { return request.offset - start; }
+      };
+
+
+      private:
+
+      uint32_t dsa_depth;		///< The most requests in flight at a time.
+
+      uint32_t dsa_flight = 0;		///< The requests in flight now.
+
+      int dsa_ring = -1;		///< The io_uring instance, if there is one.
+
+      void * dsa_rings = MAP_FAILED;	///< The submission and completion rings, mapped together.
+
+      size_t dsa_rings_size = 0;
+
+      void * dsa_sqes = MAP_FAILED;	///< The submission queue entries.
+
+      size_t dsa_sqes_size = 0;
+
+      uint32_t dsa_queued = 0;		///< The entries not passed to the kernel yet.
+
+#ifdef DS_IO_URING
+      io_uring_params dsa_params = { };
+#endif
+
+      // The fallback
+      vector<std::thread> dsa_threads;
+
+      std::mutex dsa_lock;
+
+      std::condition_variable dsa_work;		///< Where the threads wait for requests.
+
+      std::condition_variable dsa_finish;	///< Where complete() waits for them.
+
+      std::deque<Request*> dsa_waiting;		///< The requests no thread has taken yet.
+
+      vector<Request*> dsa_finished;		///< The requests the threads have done.
+
+      bool dsa_stop = false;
+
+
+      //**************************************************************************************
+
+      /** A word shared with the kernel, at the given offset in the rings. */
+      inline std::atomic_ref<uint32_t> ringWord(uint32_t offset)
+      {
+         return std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t*>(
+         				reinterpret_cast<byte*>(dsa_rings) + offset));
+      }
+
+
+      //**************************************************************************************
+
+      /** Sets up the io_uring instance; returns false if that isn't possible. The
+      submission and completion rings are mapped as one (IORING_FEAT_SINGLE_MMAP,
+      Linux 5.4), which leaves out only the oldest kernels. */
+      bool setUpRing()
+      {
+#ifdef DS_IO_URING
+         dsa_ring = syscall(__NR_io_uring_setup, dsa_depth, &dsa_params);
+         if ( dsa_ring < 0 ) return false;
+
+         size_t sq = dsa_params.sq_off.array + dsa_params.sq_entries * sizeof(uint32_t);
+         size_t cq = dsa_params.cq_off.cqes + dsa_params.cq_entries * sizeof(io_uring_cqe);
+         dsa_rings_size = ( sq > cq ) ? sq : cq;
+         dsa_sqes_size = dsa_params.sq_entries * sizeof(io_uring_sqe);
+
+         if ( dsa_params.features & IORING_FEAT_SINGLE_MMAP ) {
+            dsa_rings = mmap(nullptr, dsa_rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            						dsa_ring, IORING_OFF_SQ_RING);
+            if ( dsa_rings != MAP_FAILED )
+               dsa_sqes = mmap(nullptr, dsa_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               						dsa_ring, IORING_OFF_SQES);
+         }
+
+         if ( dsa_sqes != MAP_FAILED ) return true;
+
+         tearDownRing();
+#endif
+         return false;
+      }
+
+
+      //**************************************************************************************
+
+      void tearDownRing()
+      {
+         if ( dsa_sqes != MAP_FAILED ) munmap(dsa_sqes, dsa_sqes_size);
+         if ( dsa_rings != MAP_FAILED ) munmap(dsa_rings, dsa_rings_size);
+         if ( dsa_ring >= 0 ) close(dsa_ring);
+         dsa_sqes = dsa_rings = MAP_FAILED;
+         dsa_ring = -1;
+      }
+
+
+      //**************************************************************************************
+
+      /** Passes the queued entries to the kernel, and optionally waits for at least
+      one completion. Returns false if the kernel is busy (EBUSY: the completion
+      ring is full; EAGAIN: out of resources for now), so that the completions are
+      reaped before trying again. */
+      bool enter(bool wait)
+      {
+#ifdef DS_IO_URING
+         for ( ; ; ) {
+            long r = syscall(__NR_io_uring_enter, dsa_ring, dsa_queued, wait ? 1 : 0,
+            				wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if ( r >= 0 ) {
+               dsa_queued -= r;
+               return true;
+            }
+            if ( errno == EAGAIN || errno == EBUSY ) return false;
+            if ( errno != EINTR )
+               throw DataSourceException(DSEXC_B_AIO, DSEXC_M_AIO, DSEXC_A_COPY_DATA, strerror(errno));
+         }
+#endif
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Marks the requests in the completion ring as done, and empties it. Returns
+      how many it has marked. */
+      uint32_t reap()
+      {
+         uint32_t count = 0;
+
+#ifdef DS_IO_URING
+         uint32_t head = ringWord(dsa_params.cq_off.head).load(std::memory_order_relaxed);
+         uint32_t tail = ringWord(dsa_params.cq_off.tail).load(std::memory_order_acquire);
+         uint32_t mask = ringWord(dsa_params.cq_off.ring_mask).load(std::memory_order_relaxed);
+         io_uring_cqe * cqes = reinterpret_cast<io_uring_cqe*>(
+         				reinterpret_cast<byte*>(dsa_rings) + dsa_params.cq_off.cqes);
+
+         for ( ; head != tail; head++, count++) {
+            Request * q = reinterpret_cast<Request*>(uintptr_t(cqes[head & mask].user_data));
+            q->result = cqes[head & mask].res;
+            q->done = true;
+         }
+         ringWord(dsa_params.cq_off.head).store(head, std::memory_order_release);
+         dsa_flight -= count;
+#endif
+         return count;
+      }
+
+
+      //**************************************************************************************
+
+      /** The loop of one thread of the fallback. */
+      void work()
+      {
+         std::unique_lock<std::mutex> guard(dsa_lock);
+
+         for ( ; ; ) {
+            dsa_work.wait(guard, [this]() { return dsa_stop || !dsa_waiting.empty(); });
+            if ( dsa_stop ) return;
+
+            Request * q = dsa_waiting.front();
+            dsa_waiting.pop_front();
+            guard.unlock();
+
+            ssize_t r;
+            do r = q->writing ? pwritev(q->fd, &q->io, 1, q->offset) : preadv(q->fd, &q->io, 1, q->offset);
+            while ( r < 0 && errno == EINTR );
+            if ( r < 0 ) r = -errno;
+
+            guard.lock();
+            q->result = r;
+            dsa_finished.push_back(q);
+            dsa_finish.notify_one();
+         }
+      }
+
+
+      public:
+
+
+      //**************************************************************************************
+
+      /** Allows up to "depth" requests in flight; "threads" forces the fallback. */
+      DataSourceAio(uint32_t depth = 4, bool threads = false) : dsa_depth(depth)
+      {
+         if ( !threads && setUpRing() ) return;
+
+         for (uint32_t t = 0; t < depth; t++) dsa_threads.emplace_back([this]() { work(); });
+      }
+
+
+      //**************************************************************************************
+
+      /** Whether a transfer may be done with O_DIRECT. */
+      static inline bool aligned(const void * data, size_t bytes, off_t offset)
+      {
+         return reinterpret_cast<uintptr_t>(data) % DS_DIRECT_ALIGN == 0 &&
+         	bytes % DS_DIRECT_ALIGN == 0 && offset % DS_DIRECT_ALIGN == 0;
+      }
+
+
+      //**************************************************************************************
+
+      /** Whether the requests go through io_uring. */
+      inline bool dataSourceRing() const { return dsa_ring >= 0; }
+
+
+      //**************************************************************************************
+
+      /** The number of requests in flight. */
+      inline uint32_t inFlight() const { return dsa_flight; }
+
+
+      //**************************************************************************************
+
+      /** Starts a request; there must be fewer than "depth" in flight. With io_uring,
+      it only reaches the kernel with the next complete(). */
+      void submit(Request & q)
+      {
+         assert(dsa_flight < dsa_depth);
+
+         q.done = false;
+         dsa_flight++;
+
+#ifdef DS_IO_URING
+         if ( dsa_ring >= 0 ) {
+            uint32_t tail = ringWord(dsa_params.sq_off.tail).load(std::memory_order_relaxed);
+            uint32_t index = tail & ringWord(dsa_params.sq_off.ring_mask).load(std::memory_order_relaxed);
+            io_uring_sqe & e = reinterpret_cast<io_uring_sqe*>(dsa_sqes)[index];
+
+            memset(&e, 0, sizeof(e));
+            e.opcode = q.writing ? IORING_OP_WRITEV : IORING_OP_READV;
+            e.fd = q.fd;
+            e.addr = reinterpret_cast<uintptr_t>(&q.io);
+            e.len = 1;
+            e.off = q.offset;
+            e.user_data = reinterpret_cast<uintptr_t>(&q);
+
+            reinterpret_cast<uint32_t*>(reinterpret_cast<byte*>(dsa_rings) + dsa_params.sq_off.array)[index] = index;
+            ringWord(dsa_params.sq_off.tail).store(tail + 1, std::memory_order_release);
+            dsa_queued++;
+            return;
+         }
+#endif
+         std::lock_guard<std::mutex> guard(dsa_lock);
+         dsa_waiting.push_back(&q);
+         dsa_work.notify_one();
+      }
+
+
+      //**************************************************************************************
+
+      /** Marks the requests that have finished as done, having first waited for one,
+      if asked to and there are any in flight. Returns how many it has marked. If
+      the kernel is busy and nothing can be reaped to make room, it returns without
+      waiting; the entries not passed to the kernel yet go with the next call. */
+      uint32_t complete(bool wait)
+      {
+         uint32_t count = 0;
+         wait = wait && dsa_flight;
+
+#ifdef DS_IO_URING
+         if ( dsa_ring >= 0 ) {
+            for ( ; ; ) {
+               bool entered = !( dsa_queued || wait ) || enter(wait);
+               uint32_t reaped = reap();
+               count += reaped;
+
+               if ( entered || reaped == 0 || !dsa_queued ) return count;
+               wait = false;
+            }
+         }
+#endif
+         std::unique_lock<std::mutex> guard(dsa_lock);
+         if ( wait ) dsa_finish.wait(guard, [this]() { return !dsa_finished.empty(); });
+
+         for (Request * q : dsa_finished) q->done = true;
+         count = dsa_finished.size();
+         dsa_finished.clear();
+         dsa_flight -= count;
+         return count;
+      }
+
+
+      //**************************************************************************************
+
+      /** Waits until no request is in flight. */
+      void drain() noexcept
+      {
+         try {
+            while ( dsa_flight ) complete(true);
+         } catch (...) { }
+      }
+
+
+      //**************************************************************************************
+
+      ~DataSourceAio()
+      {
+         drain();
+         tearDownRing();
+
+         {
+            std::lock_guard<std::mutex> guard(dsa_lock);
+            dsa_stop = true;
+            dsa_work.notify_all();
+         }
+         for (auto & t : dsa_threads) t.join();
+      }
+
+   };
+
+
+
+   /* A consumer that writes what it reads from a data source to a file, keeping
+   several writes in flight (see DataSourceAio) straight from the buffer. The items
+   of a write are released once it, and all the writes before it, have completed;
+   the buffer isn't held meanwhile, so the writes overlap with the work of the
+   producer and of the other readers. A write is normally "chunk" items long; a
+   shorter one is started only where the buffer wraps around, or when no other
+   write is in flight. If the file has been opened with O_DIRECT, it keeps it as
+   long as the writes are aligned to DS_DIRECT_ALIGN (the buffer itself is aligned
+   to a page, if it has a page or more), and loses it from the first one that
+   isn't, e.g. the shorter one at the end. A data source that follows the load (see
+   setDataSourceResizing()) is pinned while writes are in flight, so that the
+   items don't move from under them. */
+   template<typename ITEM> class DataSourceFileSink
+   {
+
+      private:
+
+      typename DataSource<ITEM>::Reader dsk_reader;
+
+      int dsk_fd;
+
+      off_t dsk_offset;			///< Where the next write goes in the file.
+
+      uint32_t dsk_chunk;
+
+      uint32_t dsk_depth;
+
+      bool dsk_direct;			///< Whether the file is still written with O_DIRECT.
+
+      uint64_t dsk_written = 0;		///< The items written so far.
+
+      uint32_t dsk_held = 0;		///< The items the writes in flight are for.
+
+      std::deque<DataSourceAio::Transfer> dsk_writes;	///< The writes in flight, in order.
+
+      DataSourceAio dsk_aio;		/**< Declared after the writes, so that it is destroyed
+      					 (and waits for them) first. */
+
+
+      //**************************************************************************************
+
+      /** Picks up the completions, waiting for one if asked to. A short write goes
+      on from where it has stopped, and a failed one is thrown. Returns the number
+      of items written by the completed writes at the front, which are let go. */
+      uint32_t collect(bool wait)
+      {
+         dsk_aio.complete(wait);
+
+         for (auto & t : dsk_writes) {
+            DataSourceAio::Request & q = t.request;
+            if ( !q.done || q.io.iov_len == 0 ) continue;
+
+            if ( q.result < 0 && q.result != -EINTR && q.result != -EAGAIN )
+               throw DataSourceException(DSEXC_B_AIO, DSEXC_M_FILE_SINK, DSEXC_A_COPY_DATA,
+               					strerror(-q.result));
+
+            if ( q.result > 0 ) {
+               q.io.iov_base = reinterpret_cast<byte*>(q.io.iov_base) + q.result;
+               q.io.iov_len -= q.result;
+               q.offset += q.result;
+            }
+            if ( q.io.iov_len == 0 ) continue;
+
+            if ( dsk_direct && !DataSourceAio::aligned(q.io.iov_base, q.io.iov_len, q.offset) ) {
+               fcntl(dsk_fd, F_SETFL, fcntl(dsk_fd, F_GETFL) & ~O_DIRECT);
+               dsk_direct = false;
+            }
+            dsk_aio.submit(q);
+         }
+
+         uint32_t released = 0;
+         while ( !dsk_writes.empty() && dsk_writes.front().request.done &&
+         	 dsk_writes.front().request.io.iov_len == 0 ) {
+            released += dsk_writes.front().items;
+            dsk_held -= dsk_writes.front().items;
+            dsk_writes.pop_front();
+            dsk_reader.unpinDataSource();
+         }
+         return released;
+      }
+
+
+      public:
+
+
+      //**************************************************************************************
+
+      /** Writes what the reader of the given token reads to "fd", from "offset" on,
+      with up to "depth" writes of "chunk" items (by default, as many as fit into
+      64 KiB, but no more than half the buffer) in flight. "threads" makes it use
+      the threads of DataSourceAio instead of io_uring. */
+      DataSourceFileSink(DataSource<ITEM> & source, uint32_t token, int fd, off_t offset = 0,
+      			uint32_t chunk = 0, uint32_t depth = 4, bool threads = false)
+      : dsk_reader(source.reader(token)), dsk_fd(fd), dsk_offset(offset), dsk_depth(depth),
+        dsk_aio(depth, threads)
+      {
+         uint32_t half = ( source.dataSourceSize() > 1 ) ? source.dataSourceSize() / 2 : 1;
+
+         dsk_chunk = ( chunk != 0 ) ? chunk : ( sizeof(ITEM) < 65536 ) ? 65536 / sizeof(ITEM) : 1;
+         if ( dsk_chunk > half ) dsk_chunk = half;
+         dsk_direct = fcntl(fd, F_GETFL) & O_DIRECT;
+      }
+
+
+      //**************************************************************************************
+
+      /** Waits for the writes still in flight, and lets the data source go. */
+      ~DataSourceFileSink()
+      {
+         dsk_aio.drain();
+         dsk_reader.unpinDataSource(dsk_writes.size());
+      }
+
+
+      //**************************************************************************************
+
+      /** Does one round of the work: releases what has been written, and starts
+      writing what has come. If there was nothing to do, and unless "wait" is false,
+      it then waits for a write to complete or for something to read. Returns false
+      once the producer has finished and everything has been written. */
+      bool step(bool wait = true)
+      {
+         uint32_t released = collect(false);
+         uint32_t available = dsk_reader.startDataSource();
+         uint32_t started = 0;
+
+         while ( available && dsk_writes.size() < dsk_depth ) {
+            DataSourceSpans<const ITEM> area = dsk_reader.peek(dsk_chunk);
+            uint32_t n = area.first.size();
+
+            if ( n < dsk_chunk && area.second.empty() && !dsk_writes.empty() ) break;
+
+            size_t bytes = size_t(n) * sizeof(ITEM);
+            if ( dsk_direct && !DataSourceAio::aligned(area.first.data(), bytes, dsk_offset) ) {
+               dsk_aio.drain();
+               fcntl(dsk_fd, F_SETFL, fcntl(dsk_fd, F_GETFL) & ~O_DIRECT);
+               dsk_direct = false;
+            }
+
+            dsk_writes.push_back({ { true, dsk_fd, { const_cast<ITEM*>(area.first.data()), bytes },
+            				dsk_offset, 0, false }, n, dsk_offset });
+            dsk_reader.pinDataSource();
+            dsk_aio.submit(dsk_writes.back().request);
+            dsk_reader.consume(n);
+            dsk_held += n;
+            dsk_offset += bytes;
+            available -= n;
+            started++;
+         }
+
+         dsk_reader.stopDataSource(dsk_reader.dataSourceBehind() - dsk_held);
+         dsk_written += released;
+         if ( started ) dsk_aio.complete(false);
+
+         if ( dsk_writes.empty() && dsk_reader.dataSourceFinished() ) return false;
+
+         if ( wait && !started && !released ) {
+            if ( dsk_writes.empty() ) dsk_reader.waitReadable(1);
+            else dsk_aio.complete(true);
+         }
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Writes everything the producer produces, until it has finished. */
+      void run() { while ( step() ) { } }
+
+
+      //**************************************************************************************
+
+      /** The number of items written to the file so far. */
+      inline uint64_t written() const { return dsk_written; }
+
+   };
+
+
+
+   /* A producer that reads its items from a file, keeping several reads in flight
+   (see DataSourceAio) straight into the free area of its buffer. The items of a
+   read are added to the buffer once it, and all the reads before it, have
+   completed; the buffer isn't held meanwhile, so the reads overlap with the work
+   of the readers. The reads are as long as the writes of DataSourceFileSink, and
+   keep O_DIRECT the same way. The producer finishes at the end of the file, and
+   a piece of an item there is left out. It must not spill (see
+   setDataSourceSpill()), since the reads go into the buffer itself; if it
+   follows the load (see setDataSourceResizing()), it is pinned while reads are
+   in flight. */
+   template<typename ITEM> class DataSourceFileSource : public DataSource<ITEM>
+   {
+
+      private:
+
+      int dsf_fd;
+
+      off_t dsf_offset;			///< Where the next read starts in the file.
+
+      uint32_t dsf_chunk;
+
+      uint32_t dsf_depth;
+
+      bool dsf_direct;
+
+      bool dsf_end = false;		///< Whether a read has come to the end of the file.
+
+      bool dsf_cut = false;		///< Whether the items added have come to the end.
+
+      uint32_t dsf_pending = 0;		///< The items the reads in flight are for.
+
+      std::deque<DataSourceAio::Transfer> dsf_reads;	///< The reads in flight, in order.
+
+      DataSourceAio dsf_aio;
+
+
+      //**************************************************************************************
+
+      /** Picks up the completions, waiting for one if asked to. A short read goes
+      on from where it has stopped, an empty one marks the end of the file, and a
+      failed one is thrown. */
+      void collect(bool wait)
+      {
+         dsf_aio.complete(wait);
+
+         for (auto & t : dsf_reads) {
+            DataSourceAio::Request & q = t.request;
+            if ( !q.done || q.io.iov_len == 0 ) continue;
+
+            if ( q.result < 0 && q.result != -EINTR && q.result != -EAGAIN )
+               throw DataSourceException(DSEXC_B_AIO, DSEXC_M_FILE_SOURCE, DSEXC_A_READ_DATA,
+               					strerror(-q.result));
+
+            if ( q.result == 0 ) {
+               q.io.iov_len = 0;
+               dsf_end = true;
+               continue;
+            }
+            if ( q.result > 0 ) {
+               q.io.iov_base = reinterpret_cast<byte*>(q.io.iov_base) + q.result;
+               q.io.iov_len -= q.result;
+               q.offset += q.result;
+            }
+            if ( q.io.iov_len == 0 ) continue;
+
+            if ( dsf_direct && !DataSourceAio::aligned(q.io.iov_base, q.io.iov_len, q.offset) ) {
+               fcntl(dsf_fd, F_SETFL, fcntl(dsf_fd, F_GETFL) & ~O_DIRECT);
+               dsf_direct = false;
+            }
+            dsf_aio.submit(q);
+         }
+      }
+
+
+      public:
+
+
+      //**************************************************************************************
+
+      /** Reads from "fd", from "offset" on, into a buffer of 2^z items in the given
+      mode, with up to "depth" reads of "chunk" items in flight; see
+      DataSourceFileSink. */
+      DataSourceFileSource(int fd, uint8_t z, uint8_t mode = DS_LOCKED, off_t offset = 0,
+      			uint32_t chunk = 0, uint32_t depth = 4, bool threads = false)
+      : DataSource<ITEM>(z, mode), dsf_fd(fd), dsf_offset(offset), dsf_depth(depth), dsf_aio(depth, threads)
+      {
+         uint32_t half = ( this->dataSourceSize() > 1 ) ? this->dataSourceSize() / 2 : 1;
+
+         dsf_chunk = ( chunk != 0 ) ? chunk : ( sizeof(ITEM) < 65536 ) ? 65536 / sizeof(ITEM) : 1;
+         if ( dsf_chunk > half ) dsf_chunk = half;
+         dsf_direct = fcntl(fd, F_GETFL) & O_DIRECT;
+      }
+
+
+      //**************************************************************************************
+
+      /** Does one round of the work: adds to the buffer what has been read, and
+      starts reading into the space the readers have released. If there was nothing
+      to do, and unless "wait" is false, it then waits for a read to complete or for
+      space. Returns false once it has come to the end of the file, and has added
+      everything before it. */
+      bool step(bool wait = true)
+      {
+         if ( dsf_end && dsf_reads.empty() ) return false;
+
+         collect(false);
+
+         this->closeDataSource();
+         DataSourceSpans<ITEM> area = this->reserveWrite(this->dataSourceFree());
+
+         // The reads in flight are for the beginning of the area, in order.
+         uint32_t index = dsf_pending, started = 0;
+
+         while ( !dsf_end && dsf_reads.size() < dsf_depth && index < area.size() ) {
+            bool low = index < area.first.size();
+            ITEM * at = low ? area.first.data() + index : area.second.data() + (index - area.first.size());
+            uint32_t n = ( low ? area.first.size() : area.size() ) - index;
+
+            if ( n > dsf_chunk ) n = dsf_chunk;
+            if ( area.size() - index < dsf_chunk && !dsf_reads.empty() ) break;
+
+            size_t bytes = size_t(n) * sizeof(ITEM);
+            if ( dsf_direct && !DataSourceAio::aligned(at, bytes, dsf_offset) ) {
+               dsf_aio.drain();
+               fcntl(dsf_fd, F_SETFL, fcntl(dsf_fd, F_GETFL) & ~O_DIRECT);
+               dsf_direct = false;
+            }
+
+            dsf_reads.push_back({ { false, dsf_fd, { at, bytes }, dsf_offset, 0, false }, n, dsf_offset });
+            this->pinDataSource();
+            dsf_aio.submit(dsf_reads.back().request);
+            dsf_offset += bytes;
+            dsf_pending += n;
+            index += n;
+            started++;
+         }
+         if ( started ) dsf_aio.complete(false);
+
+         // Nothing is added after the first read that has come short.
+         uint32_t ready = 0, done = 0;
+         while ( !dsf_reads.empty() && dsf_reads.front().request.done &&
+         	 dsf_reads.front().request.io.iov_len == 0 ) {
+            DataSourceAio::Transfer & t = dsf_reads.front();
+
+            if ( !dsf_cut ) ready += t.moved() / sizeof(ITEM);
+            dsf_cut = dsf_cut || t.moved() < t.items * sizeof(ITEM);
+            dsf_pending -= t.items;
+            dsf_reads.pop_front();
+            this->unpinDataSource();
+            done++;
+         }
+
+         this->commitWrite(ready);
+         if ( dsf_end && dsf_reads.empty() ) this->setDataSourceFinished();
+         this->openDataSource();
+
+         if ( dsf_end && dsf_reads.empty() ) return false;
+
+         if ( wait && !started && !done ) {
+            if ( dsf_reads.empty() ) this->waitWritable(1);
+            else dsf_aio.complete(true);
+         }
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Reads the whole file into the buffer, as the readers make space for it. */
+      void run() { while ( step() ) { } }
+
+   };
+
+
+#endif
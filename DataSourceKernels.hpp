@@ -0,0 +1,700 @@
+#ifndef DATA_SOURCE_KERNELS_HPP
+#define DATA_SOURCE_KERNELS_HPP
+
+#include <cinttypes>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+/* Tight loops for moving blocks of data items into and out of the buffers of data
+sources, and for converting samples from one type to another on the way. The
+vectorized variants are chosen at compile time: the AVX2 ones when compiling with
+-mavx2 (or -march=native on a machine that has it), the SSE ones on any other
+x86-64 machine, and plain C++ elsewhere. */
+
+
+   //*****************************************************************************************
+
+   /** Splits "frames" interleaved frames of CH channels into CH separate planes,
+   i.e. dest[ch][f] = src[f * CH + ch]. With the number of channels known at compile
+   time, the compiler unrolls the inner loop. */
+   template<typename T, uint32_t CH> void deinterleaveFixed(const T * src, T * const * dest,
+   								uint32_t frames)
+   {
+      T * d[CH];
+      for (uint32_t ch = 0; ch < CH; ch++) d[ch] = dest[ch];
+
+      for (uint32_t f = 0; f < frames; f++, src += CH)
+         for (uint32_t ch = 0; ch < CH; ch++) d[ch][f] = src[ch];
+   }
+
+
+   //*****************************************************************************************
+
+   /** The same as deinterleaveFixed(), for any number of channels. */
+   template<typename T> void deinterleave(const T * src, T * const * dest,
+   						uint32_t frames, uint32_t channels)
+   {
+      switch ( channels )
+      {
+         case 1: memcpy(dest[0], src, frames * sizeof(T)); return;
+         case 2: deinterleaveFixed<T, 2>(src, dest, frames); return;
+         case 6: deinterleaveFixed<T, 6>(src, dest, frames); return;
+         case 8: deinterleaveFixed<T, 8>(src, dest, frames); return;
+      }
+
+      for (uint32_t ch = 0; ch < channels; ch++) {
+         const T * s = src + ch;
+         T * d = dest[ch];
+         for (uint32_t f = 0; f < frames; f++, s += channels) d[f] = *s;
+      }
+   }
+
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+   //*****************************************************************************************
+
+   /** Stereo: four frames at a time with SSE, eight with AVX2. */
+   inline void deinterleaveStereo(const float * src, float * const * dest, uint32_t frames)
+   {
+      float * left = dest[0];
+      float * right = dest[1];
+      uint32_t f = 0;
+
+#ifdef __AVX2__
+      for ( ; f + 8 <= frames; f += 8, src += 16) {
+         __m256 a = _mm256_loadu_ps(src);		// L0 R0 L1 R1 | L2 R2 L3 R3
+         __m256 b = _mm256_loadu_ps(src + 8);		// L4 R4 L5 R5 | L6 R6 L7 R7
+         __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));	// L0 L1 L4 L5 | L2 L3 L6 L7
+         __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+         l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), _MM_SHUFFLE(3, 1, 2, 0)));
+         r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0)));
+         _mm256_storeu_ps(left + f, l);
+         _mm256_storeu_ps(right + f, r);
+      }
+#endif
+      for ( ; f + 4 <= frames; f += 4, src += 8) {
+         __m128 a = _mm_loadu_ps(src);			// L0 R0 L1 R1
+         __m128 b = _mm_loadu_ps(src + 4);		// L2 R2 L3 R3
+         _mm_storeu_ps(left + f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+         _mm_storeu_ps(right + f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+      }
+      for ( ; f < frames; f++, src += 2) { left[f] = src[0]; right[f] = src[1]; }
+   }
+
+
+   //*****************************************************************************************
+
+   /** Eight channels: transposes blocks of 8 x 8 samples with AVX, or 4 x 4 with SSE. */
+   inline void deinterleave8(const float * src, float * const * dest, uint32_t frames)
+   {
+      uint32_t f = 0;
+
+#ifdef __AVX2__
+      for ( ; f + 8 <= frames; f += 8, src += 64) {
+         __m256 r0 = _mm256_loadu_ps(src);
+         __m256 r1 = _mm256_loadu_ps(src + 8);
+         __m256 r2 = _mm256_loadu_ps(src + 16);
+         __m256 r3 = _mm256_loadu_ps(src + 24);
+         __m256 r4 = _mm256_loadu_ps(src + 32);
+         __m256 r5 = _mm256_loadu_ps(src + 40);
+         __m256 r6 = _mm256_loadu_ps(src + 48);
+         __m256 r7 = _mm256_loadu_ps(src + 56);
+
+         __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+         __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+         __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+         __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+         __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+         __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+         __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+         __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+         __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+         __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+         __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+         __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+         __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+         __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+         __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+         __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+         _mm256_storeu_ps(dest[0] + f, _mm256_permute2f128_ps(u0, u4, 0x20));
+         _mm256_storeu_ps(dest[1] + f, _mm256_permute2f128_ps(u1, u5, 0x20));
+         _mm256_storeu_ps(dest[2] + f, _mm256_permute2f128_ps(u2, u6, 0x20));
+         _mm256_storeu_ps(dest[3] + f, _mm256_permute2f128_ps(u3, u7, 0x20));
+         _mm256_storeu_ps(dest[4] + f, _mm256_permute2f128_ps(u0, u4, 0x31));
+         _mm256_storeu_ps(dest[5] + f, _mm256_permute2f128_ps(u1, u5, 0x31));
+         _mm256_storeu_ps(dest[6] + f, _mm256_permute2f128_ps(u2, u6, 0x31));
+         _mm256_storeu_ps(dest[7] + f, _mm256_permute2f128_ps(u3, u7, 0x31));
+      }
+#endif
+      for ( ; f + 4 <= frames; f += 4, src += 32) {
+         for (uint32_t half = 0; half < 8; half += 4) {
+            __m128 r0 = _mm_loadu_ps(src + half);
+            __m128 r1 = _mm_loadu_ps(src + half + 8);
+            __m128 r2 = _mm_loadu_ps(src + half + 16);
+            __m128 r3 = _mm_loadu_ps(src + half + 24);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(dest[half] + f, r0);
+            _mm_storeu_ps(dest[half + 1] + f, r1);
+            _mm_storeu_ps(dest[half + 2] + f, r2);
+            _mm_storeu_ps(dest[half + 3] + f, r3);
+         }
+      }
+      for ( ; f < frames; f++, src += 8)
+         for (uint32_t ch = 0; ch < 8; ch++) dest[ch][f] = src[ch];
+   }
+
+
+   //*****************************************************************************************
+
+   /** The float samples get the vectorized variants where there are any. */
+   template<> inline void deinterleave<float>(const float * src, float * const * dest,
+   						uint32_t frames, uint32_t channels)
+   {
+      switch ( channels )
+      {
+         case 1: memcpy(dest[0], src, frames * sizeof(float)); return;
+         case 2: deinterleaveStereo(src, dest, frames); return;
+         case 6: deinterleaveFixed<float, 6>(src, dest, frames); return;
+         case 8: deinterleave8(src, dest, frames); return;
+      }
+
+      for (uint32_t ch = 0; ch < channels; ch++) {
+         const float * s = src + ch;
+         float * d = dest[ch];
+         for (uint32_t f = 0; f < frames; f++, s += channels) d[f] = *s;
+      }
+   }
+
+#endif
+
+
+
+   /* A sample of 24 bits, as PCM streams pack it: three bytes, the least significant
+   first. */
+   struct DataSourceInt24
+   {
+      uint8_t bytes[3];
+
+      inline operator int32_t() const
+      {
+         return int32_t(uint32_t(bytes[0]) << 8 | uint32_t(bytes[1]) << 16 | uint32_t(bytes[2]) << 24) >> 8;
+      }
+
+      static inline DataSourceInt24 from(int32_t v) { return { { uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16) } }; }
+   };
+
+
+   /* The scale of a type of samples: integer samples are taken as fractions of their
+   full scale, so that e.g. the int16_t sample -32768 and the float sample -1.0 are
+   the same. The arithmetic is done in "Wide", which holds every sample exactly. */
+   template<typename T> struct DataSourceSample
+   {
+      static constexpr bool integer = false;
+      static constexpr double scale = 1.0;
+      using Wide = T;
+   };
+
+   template<> struct DataSourceSample<int16_t>
+   {
+      static constexpr bool integer = true;
+      static constexpr double scale = 32768.0;
+      using Wide = float;
+   };
+
+   template<> struct DataSourceSample<DataSourceInt24>
+   {
+      static constexpr bool integer = true;
+      static constexpr double scale = 8388608.0;
+      using Wide = float;
+   };
+
+   template<> struct DataSourceSample<int32_t>
+   {
+      static constexpr bool integer = true;
+      static constexpr double scale = 2147483648.0;
+      using Wide = double;
+   };
+
+
+   /* How convertSamples() converts: the gain applied on top of the change of scale,
+   whether floating-point results are clipped to [-1, 1] (integer ones always
+   saturate at their limits), and whether integer results get triangular dither of
+   one least significant bit, i.e. the sum of two random values of half a bit each,
+   which turns the error of rounding into noise that doesn't follow the signal. The
+   dither's generators (xorshift, one for each lane of a vector) keep their state
+   here, from one call to the next. */
+   struct DataSourceConversion
+   {
+      float gain = 1.0f;
+
+      bool clip = false;
+
+      bool dither = false;
+
+      uint32_t noise[8] = { 0x9e3779b9, 0x7f4a7c15, 0xf39cc060, 0x5ced6a1c,
+      			    0xd1b54a32, 0x2545f491, 0x68e31da4, 0xb5297a4d };
+   };
+
+
+   //*****************************************************************************************
+
+   /** The next random value of a dither generator, within [-0.5, 0.5). */
+   inline float ditherNoise(uint32_t & state)
+   {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      return float(int32_t(state)) * (1.0f / 4294967296.0f);
+   }
+
+
+   //*****************************************************************************************
+
+   /** The plain C++ variant of convertSamples(), which the compiler may vectorize
+   itself; the vectorized variants leave their last few samples to it. */
+   template<typename A, typename B> void convertSamplesPlain(const A * src, B * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      using W = std::conditional_t<std::is_same_v<typename DataSourceSample<A>::Wide, double> ||
+      				std::is_same_v<typename DataSourceSample<B>::Wide, double>, double, float>;
+      constexpr W low = DataSourceSample<B>::integer ? -DataSourceSample<B>::scale : -1.0;
+      constexpr W high = DataSourceSample<B>::integer ? DataSourceSample<B>::scale - 1.0 : 1.0;
+
+      const W k = W(c.gain) * W(DataSourceSample<B>::scale / DataSourceSample<A>::scale);
+
+      for (uint32_t i = 0; i < length; i++) {
+         W x;
+         if constexpr ( std::is_same_v<A, DataSourceInt24> ) x = W(int32_t(src[i])) * k;
+         else x = W(src[i]) * k;
+
+         if constexpr ( DataSourceSample<B>::integer ) {
+            if ( c.dither ) x += ditherNoise(c.noise[0]) + ditherNoise(c.noise[0]);
+            x = std::nearbyint(std::min(std::max(x, low), high));
+
+            if constexpr ( std::is_same_v<B, DataSourceInt24> ) dest[i] = DataSourceInt24::from(int32_t(x));
+            else dest[i] = B(x);
+
+         } else {
+            if ( c.clip ) x = std::min(std::max(x, low), high);
+            dest[i] = B(x);
+         }
+      }
+   }
+
+
+   //*****************************************************************************************
+
+   /** Converts "length" samples of type A to type B, i.e. dest[i] = src[i] brought
+   to the scale of B and multiplied by the gain, rounded to the nearest integer (and
+   saturated) if B is an integer type. The conversions between float or double and
+   the other types have vectorized variants below (those of 24-bit samples need
+   SSSE3); those between two integer types, and those between double and int16_t
+   or 24-bit samples, are plain C++, as are dithered int32_t results. */
+   template<typename A, typename B> inline void convertSamples(const A * src, B * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      convertSamplesPlain(src, dest, length, c);
+   }
+
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+   //*****************************************************************************************
+
+   /** The dither of four lanes (see ditherNoise()): the sum of two random values of
+   half a bit each, from the generators in "state". */
+   inline __m128 ditherNoise4(__m128i & state)
+   {
+      __m128 sum = _mm_setzero_ps();
+
+      for (uint32_t k = 0; k < 2; k++) {
+         state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+         state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+         state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+         sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(state), _mm_set1_ps(1.0f / 4294967296.0f)));
+      }
+      return sum;
+   }
+
+#ifdef __AVX2__
+   /** The same for eight lanes. */
+   inline __m256 ditherNoise8(__m256i & state)
+   {
+      __m256 sum = _mm256_setzero_ps();
+
+      for (uint32_t k = 0; k < 2; k++) {
+         state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+         state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+         state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+         sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_cvtepi32_ps(state), _mm256_set1_ps(1.0f / 4294967296.0f)));
+      }
+      return sum;
+   }
+#endif
+
+
+   //*****************************************************************************************
+
+   /** int16_t to float: eight samples at a time with SSE, sixteen with AVX2. */
+   template<> inline void convertSamples<int16_t, float>(const int16_t * src, float * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      const float k = c.gain / 32768.0f;
+      uint32_t i = 0;
+
+#ifdef __AVX2__
+      const __m256 k8 = _mm256_set1_ps(k);
+      for ( ; i + 16 <= length; i += 16) {
+         __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+         __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)));
+         __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)));
+         a = _mm256_mul_ps(a, k8);
+         b = _mm256_mul_ps(b, k8);
+         if ( c.clip ) {
+            a = _mm256_min_ps(_mm256_max_ps(a, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+            b = _mm256_min_ps(_mm256_max_ps(b, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+         }
+         _mm256_storeu_ps(dest + i, a);
+         _mm256_storeu_ps(dest + i + 8, b);
+      }
+#endif
+      const __m128 k4 = _mm_set1_ps(k);
+      for ( ; i + 8 <= length; i += 8) {
+         __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+         // Each sample into the upper half of a 32-bit lane, then shifted down with its sign.
+         __m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), k4);
+         __m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), k4);
+         if ( c.clip ) {
+            a = _mm_min_ps(_mm_max_ps(a, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+            b = _mm_min_ps(_mm_max_ps(b, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+         }
+         _mm_storeu_ps(dest + i, a);
+         _mm_storeu_ps(dest + i + 4, b);
+      }
+      for ( ; i < length; i++) {
+         float x = float(src[i]) * k;
+         dest[i] = c.clip ? std::min(std::max(x, -1.0f), 1.0f) : x;
+      }
+   }
+
+
+   //*****************************************************************************************
+
+   /** int32_t to float; the same way. */
+   template<> inline void convertSamples<int32_t, float>(const int32_t * src, float * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      const float k = c.gain / 2147483648.0f;
+      uint32_t i = 0;
+
+#ifdef __AVX2__
+      const __m256 k8 = _mm256_set1_ps(k);
+      for ( ; i + 8 <= length; i += 8) {
+         __m256 a = _mm256_mul_ps(_mm256_cvtepi32_ps(
+         			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i))), k8);
+         if ( c.clip ) a = _mm256_min_ps(_mm256_max_ps(a, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+         _mm256_storeu_ps(dest + i, a);
+      }
+#endif
+      const __m128 k4 = _mm_set1_ps(k);
+      for ( ; i + 4 <= length; i += 4) {
+         __m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))), k4);
+         if ( c.clip ) a = _mm_min_ps(_mm_max_ps(a, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+         _mm_storeu_ps(dest + i, a);
+      }
+      for ( ; i < length; i++) {
+         float x = float(src[i]) * k;
+         dest[i] = c.clip ? std::min(std::max(x, -1.0f), 1.0f) : x;
+      }
+   }
+
+
+   //*****************************************************************************************
+
+   /** float to int16_t: scaled, dithered if asked to, limited to the range of int16_t,
+   rounded to the nearest and packed, eight samples at a time with SSE, sixteen with
+   AVX2. Each lane has its own dither generator. */
+   template<> inline void convertSamples<float, int16_t>(const float * src, int16_t * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      const float k = c.gain * 32768.0f;
+      uint32_t i = 0;
+
+#ifdef __AVX2__
+      const __m256 k8 = _mm256_set1_ps(k), low8 = _mm256_set1_ps(-32768.0f), high8 = _mm256_set1_ps(32767.0f);
+      __m256i noise8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c.noise));
+
+      for ( ; i + 16 <= length; i += 16) {
+         __m256 x[2] = { _mm256_mul_ps(_mm256_loadu_ps(src + i), k8),
+         		 _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), k8) };
+         if ( c.dither ) {
+            x[0] = _mm256_add_ps(x[0], ditherNoise8(noise8));
+            x[1] = _mm256_add_ps(x[1], ditherNoise8(noise8));
+         }
+         __m256i a = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(x[0], low8), high8));
+         __m256i b = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(x[1], low8), high8));
+         // Packing works within each half: a0-3 b0-3 a4-7 b4-7, put in order afterwards.
+         __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), v);
+      }
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(c.noise), noise8);
+#endif
+      const __m128 k4 = _mm_set1_ps(k), low4 = _mm_set1_ps(-32768.0f), high4 = _mm_set1_ps(32767.0f);
+      __m128i noise4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c.noise));
+
+      for ( ; i + 8 <= length; i += 8) {
+         __m128 x[2] = { _mm_mul_ps(_mm_loadu_ps(src + i), k4), _mm_mul_ps(_mm_loadu_ps(src + i + 4), k4) };
+         if ( c.dither ) {
+            x[0] = _mm_add_ps(x[0], ditherNoise4(noise4));
+            x[1] = _mm_add_ps(x[1], ditherNoise4(noise4));
+         }
+         __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(x[0], low4), high4));
+         __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(x[1], low4), high4));
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_packs_epi32(a, b));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(c.noise), noise4);
+
+      for ( ; i < length; i++) {
+         float x = src[i] * k;
+         if ( c.dither ) x += ditherNoise(c.noise[0]) + ditherNoise(c.noise[0]);
+         dest[i] = int16_t(std::nearbyint(std::min(std::max(x, -32768.0f), 32767.0f)));
+      }
+   }
+
+
+   //*****************************************************************************************
+
+   /** float to double and back, four samples at a time, and int32_t to double and
+   back, computed in double like the plain variant, so that they give the same
+   results; the same goes for float to int32_t. Dithering 32-bit samples is left to
+   the plain variant. */
+   template<> inline void convertSamples<float, double>(const float * src, double * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      const double k = c.gain;
+      uint32_t i = 0;
+
+#ifdef __AVX2__
+      const __m256d k4 = _mm256_set1_pd(k), low4 = _mm256_set1_pd(-1.0), high4 = _mm256_set1_pd(1.0);
+      for ( ; i + 4 <= length; i += 4) {
+         __m256d a = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(src + i)), k4);
+         if ( c.clip ) a = _mm256_min_pd(_mm256_max_pd(a, low4), high4);
+         _mm256_storeu_pd(dest + i, a);
+      }
+#endif
+      const __m128d k2 = _mm_set1_pd(k), low2 = _mm_set1_pd(-1.0), high2 = _mm_set1_pd(1.0);
+      for ( ; i + 4 <= length; i += 4) {
+         __m128 x = _mm_loadu_ps(src + i);
+         __m128d a = _mm_mul_pd(_mm_cvtps_pd(x), k2);
+         __m128d b = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), k2);
+         if ( c.clip ) {
+            a = _mm_min_pd(_mm_max_pd(a, low2), high2);
+            b = _mm_min_pd(_mm_max_pd(b, low2), high2);
+         }
+         _mm_storeu_pd(dest + i, a);
+         _mm_storeu_pd(dest + i + 2, b);
+      }
+      convertSamplesPlain(src + i, dest + i, length - i, c);
+   }
+
+   template<> inline void convertSamples<double, float>(const double * src, float * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      const double k = c.gain;
+      uint32_t i = 0;
+
+#ifdef __AVX2__
+      const __m256d k4 = _mm256_set1_pd(k), low4 = _mm256_set1_pd(-1.0), high4 = _mm256_set1_pd(1.0);
+      for ( ; i + 4 <= length; i += 4) {
+         __m256d a = _mm256_mul_pd(_mm256_loadu_pd(src + i), k4);
+         if ( c.clip ) a = _mm256_min_pd(_mm256_max_pd(a, low4), high4);
+         _mm_storeu_ps(dest + i, _mm256_cvtpd_ps(a));
+      }
+#endif
+      const __m128d k2 = _mm_set1_pd(k), low2 = _mm_set1_pd(-1.0), high2 = _mm_set1_pd(1.0);
+      for ( ; i + 4 <= length; i += 4) {
+         __m128d a = _mm_mul_pd(_mm_loadu_pd(src + i), k2);
+         __m128d b = _mm_mul_pd(_mm_loadu_pd(src + i + 2), k2);
+         if ( c.clip ) {
+            a = _mm_min_pd(_mm_max_pd(a, low2), high2);
+            b = _mm_min_pd(_mm_max_pd(b, low2), high2);
+         }
+         _mm_storeu_ps(dest + i, _mm_movelh_ps(_mm_cvtpd_ps(a), _mm_cvtpd_ps(b)));
+      }
+      convertSamplesPlain(src + i, dest + i, length - i, c);
+   }
+
+   template<> inline void convertSamples<int32_t, double>(const int32_t * src, double * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      const double k = c.gain / 2147483648.0;
+      uint32_t i = 0;
+
+#ifdef __AVX2__
+      const __m256d k4 = _mm256_set1_pd(k), low4 = _mm256_set1_pd(-1.0), high4 = _mm256_set1_pd(1.0);
+      for ( ; i + 4 <= length; i += 4) {
+         __m256d a = _mm256_mul_pd(_mm256_cvtepi32_pd(
+         			_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))), k4);
+         if ( c.clip ) a = _mm256_min_pd(_mm256_max_pd(a, low4), high4);
+         _mm256_storeu_pd(dest + i, a);
+      }
+#endif
+      const __m128d k2 = _mm_set1_pd(k), low2 = _mm_set1_pd(-1.0), high2 = _mm_set1_pd(1.0);
+      for ( ; i + 2 <= length; i += 2) {
+         __m128d a = _mm_mul_pd(_mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i))), k2);
+         if ( c.clip ) a = _mm_min_pd(_mm_max_pd(a, low2), high2);
+         _mm_storeu_pd(dest + i, a);
+      }
+      convertSamplesPlain(src + i, dest + i, length - i, c);
+   }
+
+   template<> inline void convertSamples<double, int32_t>(const double * src, int32_t * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      const double k = c.gain * 2147483648.0;
+      uint32_t i = 0;
+
+      if ( c.dither ) { convertSamplesPlain(src, dest, length, c); return; }
+
+#ifdef __AVX2__
+      const __m256d k4 = _mm256_set1_pd(k);
+      const __m256d low4 = _mm256_set1_pd(-2147483648.0), high4 = _mm256_set1_pd(2147483647.0);
+      for ( ; i + 4 <= length; i += 4) {
+         __m256d a = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(_mm256_loadu_pd(src + i), k4), low4), high4);
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm256_cvtpd_epi32(a));
+      }
+#endif
+      const __m128d k2 = _mm_set1_pd(k), low2 = _mm_set1_pd(-2147483648.0), high2 = _mm_set1_pd(2147483647.0);
+      for ( ; i + 2 <= length; i += 2) {
+         __m128d a = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(src + i), k2), low2), high2);
+         _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + i), _mm_cvtpd_epi32(a));
+      }
+      convertSamplesPlain(src + i, dest + i, length - i, c);
+   }
+
+   template<> inline void convertSamples<float, int32_t>(const float * src, int32_t * dest, uint32_t length,
+   							DataSourceConversion & c)
+   {
+      const double k = c.gain * 2147483648.0;
+      uint32_t i = 0;
+
+      if ( c.dither ) { convertSamplesPlain(src, dest, length, c); return; }
+
+#ifdef __AVX2__
+      const __m256d k4 = _mm256_set1_pd(k);
+      const __m256d low4 = _mm256_set1_pd(-2147483648.0), high4 = _mm256_set1_pd(2147483647.0);
+      for ( ; i + 4 <= length; i += 4) {
+         __m256d a = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(src + i)), k4);
+         a = _mm256_min_pd(_mm256_max_pd(a, low4), high4);
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm256_cvtpd_epi32(a));
+      }
+#endif
+      const __m128d k2 = _mm_set1_pd(k), low2 = _mm_set1_pd(-2147483648.0), high2 = _mm_set1_pd(2147483647.0);
+      for ( ; i + 4 <= length; i += 4) {
+         __m128 x = _mm_loadu_ps(src + i);
+         __m128d a = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_cvtps_pd(x), k2), low2), high2);
+         __m128d b = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), k2), low2), high2);
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),
+         			_mm_unpacklo_epi64(_mm_cvtpd_epi32(a), _mm_cvtpd_epi32(b)));
+      }
+      convertSamplesPlain(src + i, dest + i, length - i, c);
+   }
+
+
+#ifdef __SSSE3__
+
+   //*****************************************************************************************
+
+   /** 24-bit samples to float, with a byte shuffle (SSSE3, implied by AVX2): each
+   sample goes into the upper three bytes of a lane, and is shifted down with its
+   sign. Sixteen bytes are loaded for every twelve, so the loops stop a little short
+   of the end. */
+   template<> inline void convertSamples<DataSourceInt24, float>(const DataSourceInt24 * src, float * dest,
+   							uint32_t length, DataSourceConversion & c)
+   {
+      const float k = c.gain / 8388608.0f;
+      const uint8_t * bytes = reinterpret_cast<const uint8_t*>(src);
+      const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+      uint32_t i = 0;
+
+#ifdef __AVX2__
+      const __m256i spread8 = _mm256_broadcastsi128_si256(spread);
+      const __m256 k8 = _mm256_set1_ps(k), low8 = _mm256_set1_ps(-1.0f), high8 = _mm256_set1_ps(1.0f);
+      for ( ; i + 10 <= length; i += 8) {
+         __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+         			_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 3 * i))),
+         			_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 3 * i + 12)), 1);
+         __m256 a = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_shuffle_epi8(v, spread8), 8)), k8);
+         if ( c.clip ) a = _mm256_min_ps(_mm256_max_ps(a, low8), high8);
+         _mm256_storeu_ps(dest + i, a);
+      }
+#endif
+      const __m128 k4 = _mm_set1_ps(k), low4 = _mm_set1_ps(-1.0f), high4 = _mm_set1_ps(1.0f);
+      for ( ; i + 6 <= length; i += 4) {
+         __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 3 * i));
+         __m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_shuffle_epi8(v, spread), 8)), k4);
+         if ( c.clip ) a = _mm_min_ps(_mm_max_ps(a, low4), high4);
+         _mm_storeu_ps(dest + i, a);
+      }
+      convertSamplesPlain(src + i, dest + i, length - i, c);
+   }
+
+
+   //*****************************************************************************************
+
+   /** float to 24-bit samples: scaled, dithered, limited and rounded like float to
+   int16_t, then the lower three bytes of each lane are gathered by a byte shuffle.
+   Each store writes four bytes too many, which the next one writes over, so the
+   loops stop a little short of the end. */
+   template<> inline void convertSamples<float, DataSourceInt24>(const float * src, DataSourceInt24 * dest,
+   							uint32_t length, DataSourceConversion & c)
+   {
+      const float k = c.gain * 8388608.0f;
+      uint8_t * bytes = reinterpret_cast<uint8_t*>(dest);
+      const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+      uint32_t i = 0;
+
+#ifdef __AVX2__
+      const __m256i pack8 = _mm256_broadcastsi128_si256(pack);
+      const __m256 k8 = _mm256_set1_ps(k), low8 = _mm256_set1_ps(-8388608.0f), high8 = _mm256_set1_ps(8388607.0f);
+      __m256i noise8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c.noise));
+
+      for ( ; i + 10 <= length; i += 8) {
+         __m256 x = _mm256_mul_ps(_mm256_loadu_ps(src + i), k8);
+         if ( c.dither ) x = _mm256_add_ps(x, ditherNoise8(noise8));
+         __m256i v = _mm256_shuffle_epi8(_mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(x, low8), high8)), pack8);
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes + 3 * i), _mm256_castsi256_si128(v));
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes + 3 * i + 12), _mm256_extracti128_si256(v, 1));
+      }
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(c.noise), noise8);
+#endif
+      const __m128 k4 = _mm_set1_ps(k), low4 = _mm_set1_ps(-8388608.0f), high4 = _mm_set1_ps(8388607.0f);
+      __m128i noise4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c.noise));
+
+      for ( ; i + 6 <= length; i += 4) {
+         __m128 x = _mm_mul_ps(_mm_loadu_ps(src + i), k4);
+         if ( c.dither ) x = _mm_add_ps(x, ditherNoise4(noise4));
+         __m128i v = _mm_shuffle_epi8(_mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(x, low4), high4)), pack);
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes + 3 * i), v);
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(c.noise), noise4);
+
+      convertSamplesPlain(src + i, dest + i, length - i, c);
+   }
+
+#endif
+
+#endif
+
+
+#endif
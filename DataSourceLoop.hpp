@@ -0,0 +1,327 @@
+#ifndef DATA_SOURCE_LOOP_HPP
+#define DATA_SOURCE_LOOP_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <coroutine>
+#include <deque>
+#include <DataSource.hpp>
+
+
+
+   /* A coroutine run by a DataSourceLoop, e.g. one stage of a pipeline, which
+   awaits the conditions provided by the data sources (see DataSourceCondition)
+   instead of polling them. The coroutine doesn't start until it is given to a
+   loop by spawn(); from then on, the loop owns it. */
+   class DataSourceTask
+   {
+
+      public:
+
+      struct promise_type
+      {
+         std::exception_ptr error;	///< The exception that ended the coroutine, if any.
+
+         DataSourceTask get_return_object()
+         	{ return DataSourceTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+         std::suspend_always initial_suspend() noexcept { return {}; }
+
+         std::suspend_always final_suspend() noexcept { return {}; }
+
+         void return_void() { }
+
+         void unhandled_exception() { error = std::current_exception(); }
+      };
+
+      typedef std::coroutine_handle<promise_type> Handle;
+
+
+      DataSourceTask(DataSourceTask && o) noexcept : dst_handle(o.dst_handle) { o.dst_handle = nullptr; }
+
+      DataSourceTask(const DataSourceTask &) = delete;
+
+      ~DataSourceTask() { if ( dst_handle ) dst_handle.destroy(); }
+
+
+      private:
+
+      friend class DataSourceLoop;
+
+      Handle dst_handle;
+
+      explicit DataSourceTask(Handle h) : dst_handle(h) { }
+
+   };
+
+
+
+   /* Runs any number of DataSourceTask coroutines on the calling thread. A
+   coroutine that awaits a condition which doesn't hold yet is put aside, and
+   is looked at again only once the futex word of the condition has changed;
+   when no coroutine can go on, the thread sleeps on all those words at once
+   (with futex_waitv). Each thread may run a loop of its own. */
+   class DataSourceLoop
+   {
+
+      private:
+
+      struct Waiter
+      {
+         DataSourceTask::Handle handle;
+
+         DataSourceCondition condition;
+      };
+
+      /* The coroutines waiting on one futex word. */
+      struct Watch
+      {
+         atomic<uint32_t> * event;
+
+         uint32_t seen;			///< The value of the word when they were last checked.
+
+         atomic<uint32_t> * opposite;	///< The word the other side waits on.
+
+         atomic<uint32_t> * opposite_waiting;
+
+         bool fresh;			/**< Whether a coroutine has been put aside since the
+         				 thread last went to sleep. */
+
+         vector<Waiter> waiters;
+      };
+
+
+      vector<DataSourceTask::Handle> dsl_tasks;	///< All the coroutines not finished yet.
+
+      std::deque<DataSourceTask::Handle> dsl_ready;	///< The coroutines that can go on.
+
+      vector<Watch> dsl_watches;
+
+      std::exception_ptr dsl_error;		///< The first exception that ended a coroutine.
+
+      static inline thread_local DataSourceLoop * dsl_current = nullptr;
+      					///< The loop running on this thread.
+
+
+      //**************************************************************************************
+
+      static void wake(atomic<uint32_t> & event)
+      {
+         event.fetch_add(1, std::memory_order_release);
+         syscall(SYS_futex, reinterpret_cast<uint32_t*>(&event), FUTEX_WAKE_PRIVATE, INT_MAX,
+         						nullptr, nullptr, 0);
+      }
+
+
+      //**************************************************************************************
+
+      /** The coroutines this loop has put aside on the given word. */
+      uint32_t waitersOn(atomic<uint32_t> * event)
+      {
+         for (auto & w : dsl_watches) if ( w.event == event ) return w.waiters.size();
+         return 0;
+      }
+
+
+      //**************************************************************************************
+
+      /** Looks again at the coroutines whose words have changed, and makes those
+      whose conditions hold ready. Returns whether there are any. */
+      bool poll()
+      {
+         for (auto & w : dsl_watches) {
+            uint32_t now = w.event->load(std::memory_order_acquire);
+            if ( now == w.seen ) continue;
+            w.seen = now;
+
+            std::erase_if(w.waiters, [this](Waiter & k) {
+               if ( !k.condition.ready() ) return false;
+               k.condition.waiting->fetch_sub(1);
+               dsl_ready.push_back(k.handle);
+               return true;
+            });
+         }
+
+         std::erase_if(dsl_watches, [](Watch & w) { return w.waiters.empty(); });
+         return !dsl_ready.empty();
+      }
+
+
+      //**************************************************************************************
+
+      /** Puts the thread to sleep until one of the words the coroutines wait on
+      changes. Like waitReadable() and waitWritable(), it first wakes those waiting
+      on the other side, if a coroutine has been put aside since the last time;
+      without futex_waitv, or with too many words, it sleeps on the first word for
+      a millisecond at most, and then looks at all of them. There must be a word to
+      sleep on, see run(). */
+      void sleep()
+      {
+         for (auto & w : dsl_watches) {
+            if ( !w.fresh ) continue;
+            w.fresh = false;
+            if ( w.opposite_waiting->load() > waitersOn(w.opposite) ) wake(*w.opposite);
+         }
+
+         if ( poll() ) return;
+         assert(!dsl_watches.empty());
+
+#ifdef SYS_futex_waitv
+         if ( dsl_watches.size() <= FUTEX_WAITV_MAX ) {
+            futex_waitv words[FUTEX_WAITV_MAX] = { };
+
+            for (uint32_t k = 0; k < dsl_watches.size(); k++) {
+               words[k].val = dsl_watches[k].seen;
+               words[k].uaddr = reinterpret_cast<uintptr_t>(dsl_watches[k].event);
+               words[k].flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+            }
+
+            if ( syscall(SYS_futex_waitv, words, dsl_watches.size(), 0, nullptr, CLOCK_MONOTONIC) >= 0 ||
+                 errno != ENOSYS ) return;
+         }
+#endif
+         timespec t = { 0, 1000000 };
+         syscall(SYS_futex, reinterpret_cast<uint32_t*>(dsl_watches.front().event), FUTEX_WAIT_PRIVATE,
+         				dsl_watches.front().seen, &t, nullptr, 0);
+      }
+
+
+      //**************************************************************************************
+
+      /** Ends all the coroutines, after an exception or when the loop is destroyed. */
+      void discard()
+      {
+         for (auto & w : dsl_watches)
+            for (auto & k : w.waiters) k.condition.waiting->fetch_sub(1);
+
+         dsl_watches.clear();
+         dsl_ready.clear();
+
+         for (auto h : dsl_tasks) h.destroy();
+         dsl_tasks.clear();
+      }
+
+
+      public:
+
+
+      //**************************************************************************************
+
+      /** Puts the coroutine aside until the condition holds; called by co_await.
+      Returns false if it already holds, and the coroutine should go on. */
+      bool suspend(DataSourceTask::Handle h, const DataSourceCondition & c)
+      {
+         // Once counted in, the other side changes the word whenever the condition
+         // may have come to hold; so what is checked here can't be missed.
+         c.waiting->fetch_add(1);
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         uint32_t seen = c.event->load(std::memory_order_acquire);
+
+         if ( c.ready() ) {
+            c.waiting->fetch_sub(1);
+            return false;
+         }
+
+         auto w = std::find_if(dsl_watches.begin(), dsl_watches.end(),
+         				[&](Watch & w) { return w.event == c.event; });
+         if ( w == dsl_watches.end() ) {
+            dsl_watches.push_back({ c.event, seen, c.opposite, c.opposite_waiting, false, { } });
+            w = std::prev(dsl_watches.end());
+         }
+
+         w->fresh = true;
+         w->waiters.push_back({ h, c });
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** The loop running on the calling thread, if any. */
+      static inline DataSourceLoop * current() { return dsl_current; }
+
+
+      //**************************************************************************************
+
+      /** Hands a coroutine over to the loop; it starts when the loop runs. */
+      void spawn(DataSourceTask && task)
+      {
+         dsl_tasks.push_back(task.dst_handle);
+         dsl_ready.push_back(task.dst_handle);
+         task.dst_handle = nullptr;
+      }
+
+
+      //**************************************************************************************
+
+      /** Runs the coroutines until all of them have finished. An exception that
+      ends one of them ends all the others too, and is thrown again from here; so
+      is a DataSourceException if none of those left can go on, and none awaits a
+      condition of a data source. */
+      void run()
+      {
+         DataSourceLoop * outer = dsl_current;
+         dsl_current = this;
+
+         while ( !dsl_tasks.empty() && !dsl_error ) {
+            if ( dsl_ready.empty() && !poll() ) {
+               // Coroutines that await something other than a data source would
+               // never be woken.
+               if ( dsl_watches.empty() )
+                  dsl_error = std::make_exception_ptr(
+                  		DataSourceException(DSEXC_B_STALLED, DSEXC_M_LOOP, DSEXC_A_AWAIT));
+               else sleep();
+               continue;
+            }
+
+            DataSourceTask::Handle h = dsl_ready.front();
+            dsl_ready.pop_front();
+            h.resume();
+
+            if ( h.done() ) {
+               if ( h.promise().error && !dsl_error ) dsl_error = h.promise().error;
+               std::erase(dsl_tasks, h);
+               h.destroy();
+            }
+         }
+
+         dsl_current = outer;
+
+         if ( dsl_error ) {
+            discard();
+            std::exception_ptr e = dsl_error;
+            dsl_error = nullptr;
+            std::rethrow_exception(e);
+         }
+      }
+
+
+      //**************************************************************************************
+
+      ~DataSourceLoop() { discard(); }
+
+   };
+
+
+
+   /* Makes co_await suspend the coroutine until the condition holds. */
+   struct DataSourceAwaiter
+   {
+      DataSourceCondition condition;
+
+      bool await_ready() const { return condition.ready(); }
+
+      bool await_suspend(DataSourceTask::Handle h)
+      {
+         assert(DataSourceLoop::current() != nullptr);
+
+         return DataSourceLoop::current()->suspend(h, condition);
+      }
+
+      void await_resume() const { }
+   };
+
+   inline DataSourceAwaiter operator co_await(DataSourceCondition c) { return { c }; }
+
+
+#endif
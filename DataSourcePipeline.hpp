@@ -0,0 +1,465 @@
+#ifndef DATA_SOURCE_PIPELINE_HPP
+#define DATA_SOURCE_PIPELINE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <pthread.h>
+#include <sched.h>
+#include <DataSource.hpp>
+
+
+
+   /* Runs a pipeline -- producers and consumers connected by data sources -- on a
+   pool of threads, instead of a loop that calls them in turn. Each node is a
+   callback doing one step of its work (e.g. one writing or one reading session),
+   together with a predicate telling whether the node has finished; its edges are
+   the data sources it reads from and writes to. A node is run whenever one of its
+   inputs has something for it and all its outputs have space, and after each step
+   the node and its neighbours are checked again. Each thread keeps its own queue
+   of the nodes it has found ready, and takes work from the other threads' queues
+   when its own is empty; a thread that finds no work sleeps on the futex words of
+   the data sources, like DataSourceLoop, until one of them changes. */
+
+   class DataSourcePipeline
+   {
+
+      private:
+
+      /* The states of a node. */
+      enum
+      {
+         DSP_IDLE,	// Waiting for its inputs or outputs.
+         DSP_QUEUED,	// In the queue of some thread, or being checked by one.
+         DSP_RUNNING,	// Its step is being done.
+         DSP_DONE	// Finished.
+      };
+
+      struct Node
+      {
+         string name;
+
+         std::function<void()> step;
+
+         std::function<bool()> finished;
+
+         vector<DataSourceCondition> inputs;	///< Whether each input has enough items.
+
+         vector<DataSourceCondition> outputs;	///< Whether each output has enough space.
+
+         vector<const void*> sources;		///< The data sources the node is connected to.
+
+         vector<uint32_t> neighbours;		///< The nodes connected to the same data sources.
+
+         atomic<uint8_t> state{DSP_IDLE};
+
+         atomic<bool> pending{false};		/**< Set when the node should be checked again,
+         					 but somebody else is holding it. */
+      };
+
+      struct Worker
+      {
+         std::mutex lock;
+
+         std::deque<uint32_t> queue;
+
+         vector<uint32_t> seen;		///< The values of the watched words, in sleep().
+      };
+
+      /* A futex word that the conditions of some nodes depend on. */
+      struct Watch
+      {
+         atomic<uint32_t> * event;
+
+         atomic<uint32_t> * waiting;
+
+         atomic<uint32_t> * opposite;		///< The word the other side waits on.
+
+         atomic<uint32_t> * opposite_waiting;
+
+         bool watched;			///< Whether "opposite" is watched, too.
+      };
+
+
+      vector<std::unique_ptr<Node>> dsp_nodes;
+
+      vector<std::unique_ptr<Worker>> dsp_workers;
+
+      atomic<uint32_t> dsp_remaining{0};	///< The number of nodes that haven't finished.
+
+      atomic<uint32_t> dsp_queued{0};		///< The number of nodes in all the queues.
+
+      vector<Watch> dsp_watches;		///< The words of all the nodes' conditions.
+
+      atomic<uint32_t> dsp_event{0};		/**< Changed whenever a node is queued, and when
+      					 the pipeline ends; the threads without work
+      					 sleep on it, along with dsp_watches. */
+
+      atomic<uint32_t> dsp_sleeping{0};		///< The number of threads in sleep().
+
+      std::chrono::nanoseconds dsp_rescan{0};	///< See run().
+
+      std::mutex dsp_error_lock;
+
+      std::exception_ptr dsp_error;		///< The first exception thrown by a step.
+
+      atomic<bool> dsp_stop{false};		///< Set after an exception.
+
+
+      //**************************************************************************************
+
+      /** Whether the node can do some work now. */
+      bool ready(Node & n)
+      {
+         bool input = n.inputs.empty();
+         for (auto & i : n.inputs) if ( i.ready() ) { input = true; break; }
+         if ( !input ) return false;
+
+         for (auto & o : n.outputs) if ( !o.ready() ) return false;
+         return true;
+      }
+
+
+      //**************************************************************************************
+
+      /** Wakes all the threads sleeping on "event". */
+      static void wakeAll(atomic<uint32_t> & event)
+      {
+         event.fetch_add(1, std::memory_order_release);
+         syscall(SYS_futex, reinterpret_cast<uint32_t*>(&event), FUTEX_WAKE_PRIVATE, INT_MAX,
+         						nullptr, nullptr, 0);
+      }
+
+
+      //**************************************************************************************
+
+      /** Wakes "count" of the threads in sleep(), after a node has been queued or the
+      pipeline has ended. */
+      void wake(int count)
+      {
+         dsp_event.fetch_add(1);
+         if ( dsp_sleeping.load() )
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&dsp_event), FUTEX_WAKE_PRIVATE, count,
+            						nullptr, nullptr, 0);
+      }
+
+
+      //**************************************************************************************
+
+      /** Checks the node and puts it into the queue of the given thread if it is
+      ready. If another thread is holding the node at the moment, it is only marked
+      as pending, and that thread checks it again once it lets the node go. */
+      void poke(uint32_t w, uint32_t n)
+      {
+         Node & node = *dsp_nodes[n];
+
+         node.pending.store(true);
+
+         uint8_t idle = DSP_IDLE;
+         while ( node.state.compare_exchange_strong(idle, DSP_QUEUED) ) {
+            node.pending.store(false);
+
+            if ( ready(node) ) {
+               {
+                  // Counted before it can be taken, so that take() never gets
+                  // there first.
+                  std::lock_guard<std::mutex> guard(dsp_workers[w]->lock);
+                  dsp_queued.fetch_add(1);
+                  dsp_workers[w]->queue.push_back(n);
+               }
+               wake(1);
+               return;
+            }
+
+            node.state.store(DSP_IDLE);
+            if ( !node.pending.load() ) return;
+            idle = DSP_IDLE;
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** Takes a node from the back of the thread's own queue, or else from the front
+      of another thread's queue. */
+      bool take(uint32_t w, uint32_t & n)
+      {
+         uint32_t count = dsp_workers.size();
+
+         for (uint32_t k = 0; k < count; k++) {
+            Worker & victim = *dsp_workers[(w + k) % count];
+            std::lock_guard<std::mutex> guard(victim.lock);
+
+            if ( victim.queue.empty() ) continue;
+
+            if ( k == 0 ) { n = victim.queue.back(); victim.queue.pop_back(); }
+            else { n = victim.queue.front(); victim.queue.pop_front(); }
+            dsp_queued.fetch_sub(1);
+            return true;
+         }
+         return false;
+      }
+
+
+      //**************************************************************************************
+
+      /** Binds the calling thread to the w-th of the processors it is allowed to use. */
+      static void pin(uint32_t w)
+      {
+         cpu_set_t allowed;
+         if ( sched_getaffinity(0, sizeof(allowed), &allowed) != 0 ) return;
+
+         uint32_t count = CPU_COUNT(&allowed);
+         if ( count == 0 ) return;
+
+         uint32_t k = w % count;
+         for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if ( !CPU_ISSET(cpu, &allowed) || k-- ) continue;
+
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+            return;
+         }
+      }
+
+
+      //**************************************************************************************
+
+      /** Sleeps on dsp_event and on all the watched words at once, which had the given
+      values, for the rescan interval at most; returns false if futex_waitv can't be
+      used, or there are too many words for it. */
+      bool sleepOnAll(uint32_t seen, const vector<uint32_t> & values)
+      {
+#ifdef SYS_futex_waitv
+         if ( values.size() + 1 > FUTEX_WAITV_MAX ) return false;
+
+         futex_waitv words[FUTEX_WAITV_MAX] = { };
+
+         words[0].val = seen;
+         words[0].uaddr = reinterpret_cast<uintptr_t>(&dsp_event);
+         words[0].flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+         for (uint32_t k = 0; k < values.size(); k++) {
+            words[k + 1].val = values[k];
+            words[k + 1].uaddr = reinterpret_cast<uintptr_t>(dsp_watches[k].event);
+            words[k + 1].flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+         }
+
+         // futex_waitv takes the point in time to wake up at.
+         timespec until, * deadline = nullptr;
+         if ( dsp_rescan.count() > 0 ) {
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            uint64_t ns = until.tv_nsec + std::min<uint64_t>(dsp_rescan.count(), 1000000000000000ULL);
+            until.tv_sec += ns / 1000000000;
+            until.tv_nsec = ns % 1000000000;
+            deadline = &until;
+         }
+
+         return syscall(SYS_futex_waitv, words, values.size() + 1, 0, deadline, CLOCK_MONOTONIC) >= 0 ||
+         	errno != ENOSYS;
+#else
+         return false;
+#endif
+      }
+
+
+      //**************************************************************************************
+
+      /** Puts a thread without work to sleep until a node is queued, or until one of
+      the words the nodes' conditions depend on changes. Like a coroutine awaiting
+      a condition, the thread counts itself in on all those words first, so that
+      the data sources change them, and then checks all the nodes, since they may
+      have become ready before; it also wakes the other side of a word if somebody
+      outside the pipeline waits there, as waitReadable() does. Without futex_waitv,
+      or with too many words, it sleeps on dsp_event for a millisecond at most. */
+      void sleep(uint32_t w)
+      {
+         vector<uint32_t> & values = dsp_workers[w]->seen;
+
+         dsp_sleeping.fetch_add(1);
+         for (auto & k : dsp_watches) k.waiting->fetch_add(1);
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+
+         uint32_t seen = dsp_event.load(std::memory_order_acquire);
+         values.resize(dsp_watches.size());
+         for (uint32_t k = 0; k < values.size(); k++)
+            values[k] = dsp_watches[k].event->load(std::memory_order_acquire);
+
+         for (uint32_t n = 0; n < dsp_nodes.size(); n++) poke(w, n);
+
+         if ( !dsp_queued.load() && dsp_remaining.load() && !dsp_stop.load() ) {
+            for (auto & k : dsp_watches) {
+               // The threads of the pipeline are counted in on "opposite" too, if it
+               // is watched; only somebody else has to be woken.
+               uint32_t ours = k.watched ? dsp_sleeping.load() : 0;
+               if ( k.opposite_waiting->load() > ours ) wakeAll(*k.opposite);
+            }
+
+            if ( !sleepOnAll(seen, values) ) {
+               auto ns = std::chrono::nanoseconds(1000000);
+               if ( dsp_rescan.count() > 0 ) ns = std::min(ns, dsp_rescan);
+
+               timespec t = { 0, long(ns.count()) };
+               syscall(SYS_futex, reinterpret_cast<uint32_t*>(&dsp_event), FUTEX_WAIT_PRIVATE, seen,
+               						&t, nullptr, 0);
+            }
+         }
+
+         for (auto & k : dsp_watches) k.waiting->fetch_sub(1);
+         dsp_sleeping.fetch_sub(1);
+      }
+
+
+      //**************************************************************************************
+
+      /** The loop of one thread of the pool. */
+      void work(uint32_t w)
+      {
+         while ( dsp_remaining.load() && !dsp_stop.load() ) {
+            uint32_t n;
+
+            if ( !take(w, n) ) {
+               sleep(w);
+               continue;
+            }
+
+            Node & node = *dsp_nodes[n];
+            node.state.store(DSP_RUNNING);
+
+            try {
+               node.step();
+            } catch (...) {
+               {
+                  std::lock_guard<std::mutex> guard(dsp_error_lock);
+                  if ( !dsp_error ) dsp_error = std::current_exception();
+               }
+               dsp_stop.store(true);
+               wake(INT_MAX);
+               return;
+            }
+
+            if ( node.finished() ) {
+               node.state.store(DSP_DONE);
+               if ( dsp_remaining.fetch_sub(1) == 1 ) wake(INT_MAX);
+            } else {
+               node.state.store(DSP_IDLE);
+               poke(w, n);
+            }
+
+            for (uint32_t k : node.neighbours) poke(w, k);
+         }
+      }
+
+
+      public:
+
+
+      //**************************************************************************************
+
+      /** Adds a node: "step" does one portion of its work, and "finished" tells
+      whether it has done all of it. Returns the number of the node, for
+      addInput() and addOutput(). */
+      uint32_t addNode(string name, std::function<void()> step, std::function<bool()> finished)
+      {
+         dsp_nodes.push_back(std::make_unique<Node>());
+         dsp_nodes.back()->name = name;
+         dsp_nodes.back()->step = step;
+         dsp_nodes.back()->finished = finished;
+
+         return dsp_nodes.size() - 1;
+      }
+
+
+      //**************************************************************************************
+
+      /** Tells that the node reads from the data source, using the given token.
+      The node becomes ready once at least "minItems" items are there for it, or
+      once the producer has finished. */
+      template<typename ITEM, uint8_t Z, typename INDEX> void addInput(uint32_t n,
+      		DataSource<ITEM, Z, INDEX> & s, uint32_t token, std::type_identity_t<INDEX> minItems = 1)
+      {
+         dsp_nodes[n]->inputs.push_back(s.reader(token).readable(minItems));
+         dsp_nodes[n]->sources.push_back(&s);
+      }
+
+
+      //**************************************************************************************
+
+      /** Tells that the node writes to the data source; it is ready only while
+      there is space for at least "minFree" items. */
+      template<typename ITEM, uint8_t Z, typename INDEX> void addOutput(uint32_t n,
+      		DataSource<ITEM, Z, INDEX> & s, std::type_identity_t<INDEX> minFree = 1)
+      {
+         dsp_nodes[n]->outputs.push_back(s.spaceCondition(minFree));
+         dsp_nodes[n]->sources.push_back(&s);
+      }
+
+
+      //**************************************************************************************
+
+      /** Runs the pipeline on the given number of threads (by default, one for each
+      processor) until all its nodes have finished, optionally binding each thread
+      to a processor of its own. The threads without work sleep until the data
+      sources wake them; for nodes that may also become ready through something
+      else, a "rescan" interval makes them check all the nodes at least that often.
+      An exception thrown by a step stops the pipeline, and is thrown again from
+      here. */
+      void run(uint32_t threads = 0, bool pinned = false,
+      		std::chrono::nanoseconds rescan = std::chrono::nanoseconds(0))
+      {
+         if ( threads == 0 ) threads = std::max(1u, std::thread::hardware_concurrency());
+
+         dsp_watches.clear();
+         for (auto & a : dsp_nodes) {
+            for (auto * conditions : { &a->inputs, &a->outputs })
+               for (auto & c : *conditions) {
+                  if ( std::none_of(dsp_watches.begin(), dsp_watches.end(),
+                  			[&](Watch & w) { return w.event == c.event; }) )
+                     dsp_watches.push_back({ c.event, c.waiting, c.opposite, c.opposite_waiting, false });
+               }
+         }
+         for (auto & w : dsp_watches)
+            w.watched = std::any_of(dsp_watches.begin(), dsp_watches.end(),
+            			[&](Watch & o) { return o.event == w.opposite; });
+
+         for (auto & a : dsp_nodes) {
+            a->neighbours.clear();
+            for (uint32_t k = 0; k < dsp_nodes.size(); k++) {
+               Node & b = *dsp_nodes[k];
+               if ( &b == a.get() ) continue;
+
+               bool shared = false;
+               for (const void * s : a->sources)
+                  for (const void * t : b.sources) shared = shared || s == t;
+               if ( shared ) a->neighbours.push_back(k);
+            }
+            a->state.store(DSP_IDLE);
+         }
+
+         dsp_workers.clear();
+         for (uint32_t w = 0; w < threads; w++) dsp_workers.push_back(std::make_unique<Worker>());
+         dsp_remaining.store(dsp_nodes.size());
+         dsp_queued.store(0);
+         dsp_stop.store(false);
+         dsp_rescan = rescan;
+         dsp_error = nullptr;
+
+         for (uint32_t n = 0; n < dsp_nodes.size(); n++) poke(n % threads, n);
+
+         vector<std::thread> pool;
+         for (uint32_t w = 0; w < threads; w++)
+            pool.emplace_back([this, w, pinned]() { if ( pinned ) pin(w); work(w); });
+         for (auto & t : pool) t.join();
+
+         if ( dsp_error ) std::rethrow_exception(dsp_error);
+      }
+
+   };
+
+
+#endif
@@ -11,8 +11,15 @@ uint4
 Channel::write()
 {
 
+   // PIPELINE00 NODE1: Not locking the buffer when there is nothing new in it...
+   DataSource<SAMPLE>::Reader reader = source->reader(source_token);
+   if ( reader.waitReadable(1, std::chrono::nanoseconds(0)) == 0 && !reader.dataSourceFinished() ) {
+      DBG_MSG(Channel::write, "\t\tNo new data in the circular buffer.");
+      return 0;
+   }
+
    // PIPELINE00 NODE1: Finding out the amount of new data...
-   uint4 samplesRemaining = source->startDataSource(0); 
+   uint4 samplesRemaining = source->startDataSource(source_token); 
    
    DBG_MSG(Channel::write, "\t\tFrom a circular buffer with %d samples.", samplesRemaining);
    
@@ -23,6 +30,7 @@ Channel::write()
       DBG_MSG(Channel::write, "\t\t%s", (source->dataSourceFinished() ? 
       						"Yes, it has." : "No, it hasn't."));
       if ( source->dataSourceFinished() ) setWritingFinished();
+      source->stopDataSource(0);
       return 0;
    }
    
@@ -32,17 +40,16 @@ Channel::write()
       								n_samples, samplesRemaining);
       // PIPELINE00 NODE1: Reading the data...
       source->getData(current, samplesRemaining); 
-      DBG_MSG(Channel::write, "\t\tCopied %d samples to the storage; the buffer's state:", 
-      								samplesRemaining);
-      DBG_MSG(Channel::write, "\t\t%s", source->dataSourceState());
+      DBG_MSG(Channel::write, "\t\tCopied %d samples to the storage.", samplesRemaining);
       n_samples += samplesRemaining;
       current += samplesRemaining;
    
    
    } catch (DataSourceException&) { source->dataSourceShift(-samplesRemaining); throw; }
    
-   // PIPELINE00 NODE1: Discarding the read data...
-   source->stopDataSource(samplesRemaining); 
+   // PIPELINE00 NODE1: Discarding the read data (and whatever was left from the
+   // previous sessions, if other channels have been slower)...
+   source->stopDataSource(); 
    DBG_MSG(Channel::write, "\t\tReleased %d samples from the buffer.", samplesRemaining);
 
    return samplesRemaining;
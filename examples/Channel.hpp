@@ -14,7 +14,7 @@
 
       DataSource<SAMPLE> * source = nullptr; // Where we get the sound from
 
-      uint1 source_token;		// The token used for accessing the sound source
+      uint4 source_token;		// The token used for accessing the sound source
 
       bool writing_in_progress = false;	
 
@@ -29,11 +29,12 @@
          current = storage;
       }
 
-      /* Start working with a data source; see the documentation for DataSource. */
-      inline void attach(DataSource<SAMPLE> & s) 
+      /* Start working with a data source, reading the given plane of its buffer; see
+      the documentation for DataSource. */
+      inline void attach(DataSource<SAMPLE> & s, uint1 plane = 0) 
       { 
          source = &s; 
-	 source_token = source->registerDataSource(); 
+	 source_token = source->registerDataSource(plane); 
       }
 
       /* Finish working with the data source; see the documentation for DataSource. */
@@ -43,6 +44,9 @@
 	 source = nullptr;  
       }
 
+      /* The token this channel reads the sound source with. */
+      inline uint4 sourceToken() const { return source_token; }
+
       /* Aquire sound from the sound source previously set by attach(). */
       uint4 write();
 
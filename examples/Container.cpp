@@ -3,6 +3,7 @@
 
 #include <sndfile.h>
 #include <DataSource.hpp>
+#include <DataSourceGroup.hpp>
 #include <SoundSource.hpp>
 #include <Container.hpp>
 
@@ -21,16 +22,20 @@ Container::getSound()
       // PIPELINE00 NODE0 Checking the free space in the buffer...
       uint4 minimumFree = freeSpaceInBuffers();
 
-      DBG_MSG(Container::getSound, "\t\tMinimal free amount in a channel buffer: %d", minimumFree);
+      DBG_MSG(Container::getSound, "\t\tFree amount in the channel buffers: %d", minimumFree);
       if ( minimumFree ) 
       {
-	 decoded_size = sf_readf_float(snd_file, buffer, minimumFree);
+	 if ( n_channels == 1 ) 
+	    decodeInPlace(minimumFree);
+	 else
+	    decoded_size = sf_readf_float(snd_file, buffer, minimumFree);
          DBG_MSG(Container::getSound, "\t\tDecoded frames: %d", decoded_size);
          // PIPELINE00 NODE0 Deciding whether to mark the buffer as finished...
          if ( decoded_size != minimumFree ) finishAllBuffers();
          
          untangle();
       }
+      else sound_buffer->openDataSource();
    }
 }
 
@@ -40,11 +45,10 @@ Container::getSound()
 void 
 Container::setBuffers(uint1 n) 
 { 
-   DBG_MSG(Container::setBuffers, "\tCreating %d DataSource<SAMPLE> objects...", n);
+   DBG_MSG(Container::setBuffers, "\tCreating a DataSourceGroup<SAMPLE> with %d planes...", n);
    n_channels = n; 
-   channel_buffer.reserve(n);
-   while ( n-- ) channel_buffer.emplace_back(DEFAULT_READER_CBPOW);
-   DBG_MSG(Container::setBuffers, "\tDataSource<SAMPLE> objects created.", n);
+   sound_buffer = new SoundSource(DEFAULT_READER_CBPOW, n);
+   DBG_MSG(Container::setBuffers, "\tDataSourceGroup<SAMPLE> object created.");
 }
 
 
@@ -53,17 +57,31 @@ Container::setBuffers(uint1 n)
 uint4 
 Container::freeSpaceInBuffers() 
 { 
-   for (uint1 ch = 0; ch < n_channels; ch++) channel_buffer[ch].closeDataSource(); 
+   // All the channels share one buffer, so a single session covers all of them.
+   sound_buffer->closeDataSource(); 
 
-   uint4 minimumFree = CONTAINER_FRAMES;
-   for (uint1 ch = 0; ch < n_channels; ch++) { 
-      uint4 blank = channel_buffer[ch].dataSourceFree();
-      if ( blank < minimumFree ) minimumFree = blank; 
-   }
-   return minimumFree;
+   uint4 blank = sound_buffer->dataSourceFree();
+   return (blank < CONTAINER_FRAMES) ? blank : CONTAINER_FRAMES;
 
 }
 
+//**********************************************************************************************
+
+void 
+Container::decodeInPlace(uint4 minimumFree) 
+{ 
+   // PIPELINE00 NODE0 Decoding straight into the circular buffer (a mono file)...
+   DataSourceSpans<SAMPLE> area = sound_buffer->reserveWrite(minimumFree);
+
+   decoded_size = sf_readf_float(snd_file, area.first.data(), area.first.size());
+   if ( decoded_size == area.first.size() && !area.second.empty() )
+      decoded_size += sf_readf_float(snd_file, area.second.data(), area.second.size());
+
+   sound_buffer->commitWrite(decoded_size);
+   DBG_MSG(Container::decodeInPlace, "\t\tDecoded %d frames into the channel buffer.", decoded_size);
+}
+
+
 //**********************************************************************************************
 
 void 
@@ -71,21 +89,12 @@ Container::untangle()
 { 
    DBG_MSG(Container::untangle, "\t\tFilling the channel buffers...");
 
-   // PIPELINE00 NODE0 Filling the buffer (putting individual samples)...
-   for (auto n = 0; n < decoded_size * n_channels; ) 
-   { 
-      for (uint1 ch = 0; ch < n_channels; ch++, n++) channel_buffer[ch].putData(buffer[n]); 
-      if ( (n / n_channels) % (1 << 14) == 0 ) 
-      {
-         DBG_MSG(Container::untangle, "\t\tShowing the state of the channel buffers "
-	 					"after %d frames:", n / n_channels);
-         for (uint1 ch = 0; ch < n_channels; ch++) 
-            DBG_MSG(Container::untangle, "\t\t%s", channel_buffer[ch].dataSourceState());
-      }
-   }
+   // PIPELINE00 NODE0 Filling the buffer (deinterleaving whole blocks of frames)...
+   // A mono file has already been decoded into the buffer by decodeInPlace().
+   if ( n_channels > 1 ) sound_buffer->putFrames(buffer, decoded_size);
 
    DBG_MSG(Container::untangle, "\t\tThe buffers filled; opening them for reading...");
-   for (uint1 ch = 0; ch < n_channels; ch++) { channel_buffer[ch].openDataSource(); }
+   sound_buffer->openDataSource();
 
 }
 
@@ -96,7 +105,7 @@ void
 Container::finishAllBuffers() 
 { 
    end_of_stream = true;
-   for (uint1 ch = 0; ch < n_channels; ch++) channel_buffer[ch].setDataSourceFinished(); 
+   sound_buffer->setDataSourceFinished(); 
 }
 
 
@@ -130,12 +139,8 @@ Container::Container(FILE * f) : input_file(f)
    frames = SFInfo.frames;
 
 #ifdef VERBOSE_DATA_SOURCE
-   // DEBUG - giving names to the readers.
-   char chan_ind[4]; 
-   for (uint1 n = 0; n < n_channels; n++) { 
-      sprintf(chan_ind, "%d", n); 
-      channel_buffer[n].setDataSourceName(std::string("contbuf") + chan_ind); 
-   }
+   // DEBUG - giving a name to the buffer.
+   sound_buffer->setDataSourceName(std::string("contbuf"));
 #endif
 
    buffer = reinterpret_cast<SAMPLE*>(malloc(CONTAINER_FRAMES * n_channels * sizeof(SAMPLE)));
@@ -151,5 +156,6 @@ Container::~Container()
    DBG_MSG(Container::~Container, ""); 
    sf_close(snd_file);
    if ( buffer ) free(buffer);
+   delete sound_buffer;
 }
 
@@ -26,15 +26,18 @@
 
       bool end_of_stream = false;		// Whether we have read all the sound from the file
 
-      vector<SoundSource> channel_buffer = { }; // Output circular buffers, one for each channel
+      SoundSource * sound_buffer = nullptr;	// Output circular buffer, with one plane for each channel
 
 
       // Auxiliary methods
       // ------------------------------------------------------------------------
 
-      /* Prepare the buffers, one for each channel. */
+      /* Prepare the buffer, with one plane for each channel. */
       void setBuffers(uint1 n);
 
+      /* Decode a mono file directly into its channel buffer. */
+      void decodeInPlace(uint4 minimumFree);
+
       /* Fill the channel buffers with the sound from the file. */
       void untangle();
 
@@ -61,8 +64,9 @@
 
       void getSound();
 
-      /* Export the n-th circular buffer, so that others can read from it. */
-      SoundSource & soundForChannel(uint1 n) { return channel_buffer[n]; }
+      /* Export the circular buffer, so that others can read from it; the n-th
+      channel is in its n-th plane. */
+      SoundSource & soundSource() { return *sound_buffer; }
 
 
       /** The constructor. */
@@ -1,16 +1,18 @@
 #include <dshello.hpp>
 #include <DataSource.hpp>
+#include <DataSourceGroup.hpp>
 #include <SoundSource.hpp>
 
 template class DataSource<SAMPLE>;
+template class DataSourceGroup<SAMPLE>;
 
 
-SoundSource::SoundSource(uint1 n) 
-: DataSource<SAMPLE>(n) 
+SoundSource::SoundSource(uint1 n, uint1 channels) 
+: DataSourceGroup<SAMPLE>(n, channels) 
 { }
 
 SoundSource::SoundSource(SoundSource && oSrc) noexcept 
-: DataSource<SAMPLE>(move(oSrc)) 
+: DataSourceGroup<SAMPLE>(move(oSrc)) 
 { }
 
 
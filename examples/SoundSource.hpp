@@ -1,14 +1,14 @@
 
 class Container;
 
-class SoundSource : public DataSource<SAMPLE>
+class SoundSource : public DataSourceGroup<SAMPLE>
 {
 
    friend class Container;
 
    public:
 
-   SoundSource(uint1 n);
+   SoundSource(uint1 n, uint1 channels);
 
    SoundSource(SoundSource && oSrc) noexcept;
 
@@ -0,0 +1,293 @@
+
+#include <unistd.h>    // For getopt().
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <chrono>
+#include <vector>
+#include <DataSource.hpp>
+
+
+/* Microbenchmarks of the basic DataSource operations. Each measurement passes a
+number of items through a data source in the DS_LOCKED mode, cycle by cycle: the
+producer fills the buffer in one writing session, and then every reader reads it
+all in one reading session. Only the operation being measured is timed. The results
+go to the standard output as CSV, one line per measurement:
+
+   op,item_bytes,log2_size,readers,items,ops,seconds,items_per_s,ns_per_op
+
+"items" is the number of items moved by the measured operation (for the readers,
+counted once per reader), and "ops" the number of calls to it. The operations are:
+
+   put_item	putData(ITEM), for each item
+   put_bulk	putData(ITEM*, n), once per writing session
+   get_item	getData(), for each item
+   get_bulk	getData(void*, n), once per reading session
+   item_at	dataItemAt(n), at random positions, as many times as there are items
+   shift	dataSourceShift(1), for each item
+   session	an empty writing session and the reading sessions following it */
+
+
+#define DSB_MAX_BUFFER	(256 * 1024 * 1024)	// Larger buffers (in bytes) are skipped.
+
+
+using std::chrono::steady_clock;
+
+typedef uint64_t	uint8;
+typedef uint32_t	uint4;
+
+volatile uint8_t dsb_sink;		// Keeps the compiler from dropping what was read.
+
+uint4 dsb_min_z = 8;
+uint4 dsb_max_z = 26;
+uint4 dsb_max_readers = 8;
+uint4 dsb_log2_items = 20;
+const char * dsb_only = nullptr;	// Measure only this operation.
+
+
+//**********************************************************************************************
+
+/* A data item of the given size. */
+template<size_t N> struct Item { uint8_t b[N]; };
+
+
+//**********************************************************************************************
+
+/* A producer, i.e. a data source whose writing methods may be called from outside. */
+template<typename ITEM> class Bench : public DataSource<ITEM>
+{
+   public:
+
+   using DataSource<ITEM>::closeDataSource;
+   using DataSource<ITEM>::openDataSource;
+   using DataSource<ITEM>::putData;
+   using DataSource<ITEM>::dataSourceFree;
+
+   Bench(uint4 z) : DataSource<ITEM>(z) { }
+};
+
+
+//**********************************************************************************************
+
+void
+report(const char * op, size_t itemBytes, uint4 z, uint4 readers, uint8 items, uint8 ops,
+								double seconds)
+{
+   printf("%s,%zu,%u,%u,%" PRIu64 ",%" PRIu64 ",%.6f,%.0f,%.3f\n", op, itemBytes, z, readers,
+   		items, ops, seconds, seconds > 0 ? items / seconds : 0.0,
+		ops ? seconds * 1e9 / ops : 0.0);
+   fflush(stdout);
+}
+
+
+//**********************************************************************************************
+
+inline double
+since(steady_clock::time_point start)
+{
+   return std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+
+//**********************************************************************************************
+
+/* Runs all the measurements for one item type, buffer size and number of readers. */
+template<typename ITEM> void
+measure(uint4 z, uint4 readers)
+{
+   uint4 size = 1u << z;
+   uint8 cycles = ((uint8(1) << dsb_log2_items) + size - 1) / size;
+   if ( cycles < 2 ) cycles = 2;
+
+   Bench<ITEM> src(z);
+   vector<uint4> tokens;
+   for (uint4 r = 0; r < readers; r++) tokens.push_back(src.registerDataSource());
+
+   vector<ITEM> block(size);
+   memset(block.data(), 1, size * sizeof(ITEM));
+
+   // The random positions for dataItemAt().
+   vector<uint4> positions(size);
+   uint4 x = 2463534242u;
+   for (auto & p : positions) { x ^= x << 13; x ^= x >> 17; x ^= x << 5; p = x & (size - 1); }
+
+   double seconds;
+   steady_clock::time_point start;
+
+   auto fill = [&]() { src.closeDataSource(); src.putData(block.data(), size); src.openDataSource(); };
+   auto drain = [&]() {
+      for (uint4 t : tokens) { uint4 n = src.startDataSource(t); src.dataSourceShift(n); src.stopDataSource(); }
+   };
+
+   auto wanted = [](const char * op) { return dsb_only == nullptr || strcmp(dsb_only, op) == 0; };
+
+   // Touch the whole buffer once, so that page faults don't count.
+   fill(); drain();
+
+   if ( wanted("put_item") ) {
+      seconds = 0;
+      for (uint8 c = 0; c < cycles; c++) {
+         src.closeDataSource();
+         start = steady_clock::now();
+         for (uint4 i = 0; i < size; i++) src.putData(block[i]);
+         seconds += since(start);
+         src.openDataSource();
+         drain();
+      }
+      report("put_item", sizeof(ITEM), z, readers, cycles * size, cycles * size, seconds);
+   }
+
+   if ( wanted("put_bulk") ) {
+      seconds = 0;
+      for (uint8 c = 0; c < cycles; c++) {
+         src.closeDataSource();
+         start = steady_clock::now();
+         src.putData(block.data(), size);
+         seconds += since(start);
+         src.openDataSource();
+         drain();
+      }
+      report("put_bulk", sizeof(ITEM), z, readers, cycles * size, cycles, seconds);
+   }
+
+   if ( wanted("get_item") ) {
+      seconds = 0;
+      for (uint8 c = 0; c < cycles; c++) {
+         fill();
+         for (uint4 t : tokens) {
+            uint4 n = src.startDataSource(t);
+            uint8_t sum = 0;
+            start = steady_clock::now();
+            for (uint4 i = 0; i < n; i++) sum += src.getData().b[0];
+            seconds += since(start);
+            dsb_sink = sum;
+            src.stopDataSource();
+         }
+      }
+      report("get_item", sizeof(ITEM), z, readers, cycles * size * readers, cycles * size * readers,
+      										seconds);
+   }
+
+   if ( wanted("get_bulk") ) {
+      seconds = 0;
+      for (uint8 c = 0; c < cycles; c++) {
+         fill();
+         for (uint4 t : tokens) {
+            uint4 n = src.startDataSource(t);
+            start = steady_clock::now();
+            src.getData(block.data(), n);
+            seconds += since(start);
+            dsb_sink = block[n - 1].b[0];
+            src.stopDataSource();
+         }
+      }
+      report("get_bulk", sizeof(ITEM), z, readers, cycles * size * readers, cycles * readers, seconds);
+   }
+
+   if ( wanted("item_at") ) {
+      seconds = 0;
+      for (uint8 c = 0; c < cycles; c++) {
+         fill();
+         for (uint4 t : tokens) {
+            uint4 n = src.startDataSource(t);
+            uint8_t sum = 0;
+            start = steady_clock::now();
+            for (uint4 i = 0; i < n; i++) sum += src.dataItemAt(positions[i]).b[0];
+            seconds += since(start);
+            dsb_sink = sum;
+            src.dataSourceShift(n);
+            src.stopDataSource();
+         }
+      }
+      report("item_at", sizeof(ITEM), z, readers, cycles * size * readers, cycles * size * readers,
+      										seconds);
+   }
+
+   if ( wanted("shift") ) {
+      seconds = 0;
+      for (uint8 c = 0; c < cycles; c++) {
+         fill();
+         for (uint4 t : tokens) {
+            uint4 n = src.startDataSource(t);
+            start = steady_clock::now();
+            for (uint4 i = 0; i < n; i++) src.dataSourceShift(1);
+            seconds += since(start);
+            src.stopDataSource();
+         }
+      }
+      report("shift", sizeof(ITEM), z, readers, cycles * size * readers, cycles * size * readers,
+      										seconds);
+   }
+
+   if ( wanted("session") ) {
+      uint8 sessions = uint8(1) << (dsb_log2_items > 6 ? dsb_log2_items - 6 : 0);
+      start = steady_clock::now();
+      for (uint8 c = 0; c < sessions; c++) {
+         src.closeDataSource();
+         src.openDataSource();
+         for (uint4 t : tokens) { src.startDataSource(t); src.stopDataSource(0); }
+      }
+      seconds = since(start);
+      report("session", sizeof(ITEM), z, readers, 0, sessions * (1 + readers), seconds);
+   }
+}
+
+
+//**********************************************************************************************
+
+/* Sweeps the buffer sizes and the numbers of readers for one item type. */
+template<typename ITEM> void
+sweep()
+{
+   for (uint4 z = dsb_min_z; z <= dsb_max_z; z += 2) {
+      if ( (uint8(1) << z) * sizeof(ITEM) > DSB_MAX_BUFFER ) break;
+
+      for (uint4 readers = 1; readers <= dsb_max_readers; readers *= 2)
+         measure<ITEM>(z, readers);
+   }
+}
+
+
+//**********************************************************************************************
+
+int main(int argc, char **argv)
+{
+   int option;
+
+   while ( (option = getopt(argc, argv, "z:Z:r:n:o:h")) != -1 ) {
+      switch ( option )
+      {
+         case 'z': dsb_min_z = atoi(optarg); break;
+         case 'Z': dsb_max_z = atoi(optarg); break;
+         case 'r': dsb_max_readers = atoi(optarg); break;
+         case 'n': dsb_log2_items = atoi(optarg); break;
+         case 'o': dsb_only = optarg; break;
+         default:
+            fprintf(stderr, "Usage: %s [-z min log2 size] [-Z max log2 size] [-r max readers]\n"
+	    		    "       [-n log2 items per measurement] [-o operation]\n", argv[0]);
+            return option == 'h' ? 0 : 1;
+      }
+   }
+   if ( dsb_max_z > 26 ) dsb_max_z = 26;
+
+   try
+   {
+      puts("op,item_bytes,log2_size,readers,items,ops,seconds,items_per_s,ns_per_op");
+
+      sweep<Item<1>>();
+      sweep<Item<2>>();
+      sweep<Item<4>>();
+      sweep<Item<8>>();
+      sweep<Item<16>>();
+      sweep<Item<32>>();
+      sweep<Item<64>>();
+   }
+   catch (exception & e)
+   {
+      fprintf(stderr, "%s\n", e.what());
+      return -1;
+   }
+
+   return 0;
+}
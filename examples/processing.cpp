@@ -2,6 +2,8 @@
 #include <dshello.hpp>
 
 #include <DataSource.hpp>
+#include <DataSourceGroup.hpp>
+#include <DataSourcePipeline.hpp>
 #include <SoundSource.hpp>
 #include <Channel.hpp>
 #include <sndfile.h>
@@ -47,7 +49,7 @@ loadFile(const char * fileName)
       // PIPELINE00: Assembling...
       DBG_MSG(loadFile, "\t\t\tConnecting the channels to the container...");
       for (uint1 n = 0; n < c->channels(); n++) {
-	 std::next(d->begin(), n)->attach(c->soundForChannel(n));
+	 std::next(d->begin(), n)->attach(c->soundSource(), n);
          DBG_MSG(loadFile, "\t\t\t\"%s\" connected.", 
 	 			std::next(d->begin(), n)->name().data());
       }
@@ -55,43 +57,36 @@ loadFile(const char * fileName)
       DBG_MSG(loadFile, "\t\t\tMarking the writing operation as started...");
       for (auto ch = d->begin(); ch != d->end(); ch++) { ch->setWritingStarted(); }
  
-      uint8 frames_decoded = 0;
-      bool pipelinesWork = true;
+      // PIPELINE00: Handing the nodes over to the executor...
+      DataSourcePipeline pipeline;
 
-      do 
-      {
- 
-         DBG_MSG(loadFile, "\t\t\t=========================================================");
-         DBG_MSG(loadFile, "\t\t\tLoading from the frame %ld.", frames_decoded);
-         DBG_MSG(loadFile, "\t\t\t=========================================================");
-         DBG_MSG(loadFile, "\t\t\t===> Operating the container...");
-
-	 // PIPELINE00 NODE0 Operated from here...
-         c->getSound();
-         
-         DBG_MSG(loadFile, "\t\t\t===> Operating the writer...");
-
-	 uint4 samplesAdded;
-
-	 for (auto ch = d->begin(); ch != d->end(); ch++) 
-	 { 
-            DBG_MSG(loadFile, "\t\t\t--> Starting filling %s with %d samples...", 
-	    						ch->name().data(), c->amount());
-	    // PIPELINE00 NODE1 Operated from here (we consider a channel the receiver)...
-	    samplesAdded = ch->write(); 
-            if ( samplesAdded ) 
-               DBG_MSG(loadFile, "\t\t\t%s filled.", ch->name().data());
-	 }
- 
-         frames_decoded += samplesAdded;
+      // PIPELINE00 NODE0 Operated by the executor...
+      uint32_t container = pipeline.addNode("container", 
+      				[c]() { c->getSound(); }, [c]() { return c->done(); });
+      pipeline.addOutput(container, c->soundSource());
 
-	 for (auto ch = d->begin(); ch != d->end(); ch++) 
-	 { 
-            if ( ch->writingFinished() ) pipelinesWork = false;
-	    else { pipelinesWork = true; break; }
-	 }
+      // PIPELINE00 NODE1 Operated by the executor (we consider a channel the receiver)...
+      for (auto ch = d->begin(); ch != d->end(); ch++) 
+      {
+         Channel * channel = &*ch;
+         uint32_t node = pipeline.addNode(channel->name(), 
+         		[channel]() { channel->write(); }, [channel]() { return channel->writingFinished(); });
+         pipeline.addInput(node, c->soundSource(), channel->sourceToken());
+      }
 
-      } while ( pipelinesWork );
+      DBG_MSG(loadFile, "\t\t\t=========================================================");
+      DBG_MSG(loadFile, "\t\t\tRunning the pipeline...");
+      DBG_MSG(loadFile, "\t\t\t=========================================================");
+      pipeline.run();
+
+#ifdef DATA_SOURCE_STATS
+      DataSourceStats stats = c->soundSource().dataSourceStats();
+      DBG_MSG(loadFile, "\t\t\tThe buffer: %lu items written in %lu sessions (%lu with the buffer full);",
+      				stats.items_written, stats.write_sessions, stats.write_stalls);
+      DBG_MSG(loadFile, "\t\t\t%lu items read in %lu sessions (%lu found nothing new); at most %lu items",
+      				stats.items_read, stats.read_sessions, stats.empty_reads, stats.high_water);
+      DBG_MSG(loadFile, "\t\t\tin the buffer; %.3f ms spent waiting for access.", stats.access_wait_ns / 1e6);
+#endif
  
       // PIPELINE00: Disassembling...
       DBG_MSG(loadFile, "\t\t\tDisconnecting the sources...");